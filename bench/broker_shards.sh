@@ -0,0 +1,33 @@
+#!/bin/sh
+# broker_shards.sh: escalado del broker con shards por núcleo (-n).
+#
+# Para cada valor de SHARDS arranca un broker con -n <shards>, SUBS
+# suscriptores a 'bench/#' en modo sumidero y un publisher multihilo
+# (THREADS hilos x CONNS conexiones, tópicos bench/<k>) sin límite de ritmo
+# durante DUR segundos. Se imprimen el ritmo de ingesta confirmado, los DATA
+# repartidos por el broker y cuántos mensajes cruzaron entre shards. Los
+# suscriptores y las conexiones del publisher caen en shards distintos según
+# el hash de SO_REUSEPORT, así que parte del fan-out viaja por las colas entre
+# shards; con un solo núcleo los shards no aportan paralelismo.
+#
+# Uso: bench/broker_shards.sh   (variables: BIN PORT SHARDS SUBS THREADS CONNS SIZE DUR WINDOW)
+PORT=${PORT:-9560}
+SHARDS=${SHARDS:-"1 2 4"}
+SUBS=${SUBS:-4}
+THREADS=${THREADS:-2}
+CONNS=${CONNS:-4}
+SIZE=${SIZE:-128}
+DUR=${DUR:-2}
+WINDOW=${WINDOW:-32}
+. "$(dirname "$0")/lib.sh"
+
+echo "broker con shards: $SUBS suscriptores, publisher $THREADS hilos x $CONNS conexiones, $SIZE B, $DUR s"
+for n in $SHARDS; do
+    broker_start -w "$WINDOW" -n "$n"
+    subs_start "$SUBS" 'bench/#' -S 1000
+    pub_run bench 0 -s "$SIZE" -T "$DUR" -w "$WINDOW" -N "$THREADS" -M "$CONNS"
+    bench_stop
+    x=$(broker_stat entre_hilos)
+    printf '%2d shards: %8s msg/s ingesta  %9s DATA repartidos  %9s entre shards\n' "$n" "$(pub_rate)" \
+        "$(broker_stat data_tx)" "${x:-0}"
+done
@@ -0,0 +1,69 @@
+#!/bin/sh
+# delivery.sh: comprobaciones de entrega (pasa/falla) sobre los contadores de
+# los suscriptores, en lugar de medir rendimiento.
+#
+#   - reorden: SUBS suscriptores con un SO_RCVBUF chico (RCVBUF bytes) pierden
+#     ráfagas del fan-out; las retransmisiones llegan fuera de orden y cada uno
+#     debe entregar los MSGS mensajes, ni uno más ni uno menos.
+#   - duplicados: un suscriptor que retiene sus ACK (-a/-d) más que el PTO del
+#     broker recibe retransmisiones repetidas; debe descartarlas todas.
+#   - comodines: un publisher con 4 conexiones publica en w/0..w/3 y cada
+#     filtro recibe exactamente lo que casa ('w/1' un cuarto, 'w/+', 'w/#' y
+#     '#' todo, 'w' y 'w/+/x' nada).
+#   - shards: lo mismo que comodines con el broker en -n 2 y en -f 2.
+# Termina con código 1 si falla alguna aserción.
+#
+# Uso: bench/delivery.sh   (variables: BIN PORT SUBS MSGS WINDOW RCVBUF)
+PORT=${PORT:-9600}
+SUBS=${SUBS:-8}
+MSGS=${MSGS:-2000}
+WINDOW=${WINDOW:-64}
+RCVBUF=${RCVBUF:-8192}
+. "$(dirname "$0")/lib.sh"
+
+echo "reorden: $SUBS suscriptores x $MSGS mensajes, ventana $WINDOW, SO_RCVBUF $RCVBUF"
+broker_start -w "$WINDOW"
+subs_start "$SUBS" bench -r "$RCVBUF"
+pub_run bench "$MSGS" -w "$WINDOW"
+bench_stop 3   # las últimas retransmisiones pueden ir con backoff
+reord=0
+for i in $(seq 0 $((SUBS - 1))); do
+    expect "suscriptor $i entregados" "$(sub_stat "$i" entregados)" "$MSGS"
+    expect "suscriptor $i perdidos" "$(sub_stat "$i" perdidos)" 0
+    reord=$((reord + $(sub_stat "$i" reordenados)))
+done
+echo "  ($reord entregas esperaron en el buffer de reordenación, $(broker_stat retx) retransmisiones)"
+
+echo "duplicados: ACK retenido 1 s, 100 mensajes"
+broker_start
+sub_start lento bench -a 1000 -d 1000
+sleep 0.5
+pub_run bench 100
+bench_stop 4
+expect "entregados" "$(sub_stat lento entregados)" 100
+expect_gt "duplicados descartados" "$(sub_stat lento duplicados)" 0
+
+wildcards() {   # $1 = etiqueta, $2 = flags del broker
+    echo "comodines $1: $MSGS mensajes en w/0..w/3"
+    broker_start $2
+    sub_start exacto w/1 -S 1000
+    sub_start mas 'w/+' -S 1000
+    sub_start almohadilla 'w/#' -S 1000
+    sub_start todo '#' -S 1000
+    sub_start raiz w -S 1000
+    sub_start nada 'w/+/x' -S 1000
+    sleep 0.5
+    pub_run w "$MSGS" -N 1 -M 4 -K 4 -R 20000
+    bench_stop 1
+    expect "w/1" "$(sub_stat exacto entregados)" $((MSGS / 4))
+    expect "w/+" "$(sub_stat mas entregados)" "$MSGS"
+    expect "w/#" "$(sub_stat almohadilla entregados)" "$MSGS"
+    expect "#" "$(sub_stat todo entregados)" "$MSGS"
+    expect "w" "$(sub_stat raiz entregados)" 0
+    expect "w/+/x" "$(sub_stat nada entregados)" 0
+}
+wildcards "(un hilo)" ""
+wildcards "(-n 2)" "-n 2"
+wildcards "(-f 2)" "-f 2"
+
+bench_result
@@ -0,0 +1,31 @@
+#!/bin/sh
+# fanout_batch.sh: fan-out del broker con un sendto() por DATA (-B 1) frente a
+# lotes de sendmmsg().
+#
+# Lanza un broker, SUBS suscriptores del mismo tópico y un publisher que envía
+# MSGS mensajes con ventana WINDOW. Cada DATA se replica a todos los
+# suscriptores; para cada tamaño de lote se imprimen las syscalls de envío por
+# datagrama (contador del broker) y el tiempo total.
+#
+# Uso: bench/fanout_batch.sh   (variables: BIN PORT SUBS MSGS WINDOW BATCHES DEADLINE)
+PORT=${PORT:-9470}
+SUBS=${SUBS:-64}
+MSGS=${MSGS:-2000}
+WINDOW=${WINDOW:-64}
+BATCHES=${BATCHES:-"1 8 32 64"}
+DEADLINE=${DEADLINE:-200}
+. "$(dirname "$0")/lib.sh"
+
+run() {   # $1 = tamaño de lote de envío (-B)
+    broker_start -w "$WINDOW" -B "$1" -F "$DEADLINE"
+    subs_start "$SUBS" bench
+    start=$(now_ns)
+    pub_run bench "$MSGS" -w "$WINDOW"
+    ms=$(ms_since "$start")
+    bench_stop
+    printf 'lote_tx=%-3s syscalls/datagrama=%s  %d DATA enviados, publisher %d ms\n' "$1" \
+        "$(broker_stat tx_syscalls/msg)" "$(broker_stat data_tx)" "$ms"
+}
+
+echo "fan-out: $SUBS suscriptores x $MSGS mensajes, ventana $WINDOW, plazo ${DEADLINE}us"
+for b in $BATCHES; do run "$b"; done
@@ -0,0 +1,30 @@
+#!/bin/sh
+# fanout_pacing.sh: ráfagas de fan-out con y sin pacing en el broker.
+#
+# Lanza un broker, SUBS suscriptores con un SO_RCVBUF chico (RCVBUF bytes) y un
+# publisher que envía MSGS mensajes con ventana WINDOW. Cada DATA se replica a
+# todos los suscriptores, así que sin pacing el broker emite ráfagas de sendto()
+# que desbordan los buffers de recepción. Se repite con pacing (-p) y se compara
+# la tasa de pérdida estimada por el broker (retransmisiones / envíos).
+#
+# Uso: bench/fanout_pacing.sh   (variables: BIN PORT SUBS MSGS WINDOW RCVBUF)
+PORT=${PORT:-9400}
+SUBS=${SUBS:-16}
+MSGS=${MSGS:-2000}
+WINDOW=${WINDOW:-64}
+RCVBUF=${RCVBUF:-8192}
+. "$(dirname "$0")/lib.sh"
+
+run() {   # $1 = etiqueta, $2 = flags del broker
+    broker_start -w "$WINDOW" $2
+    subs_start "$SUBS" bench -r "$RCVBUF"
+    start=$(now_ns)
+    pub_run bench "$MSGS" -w "$WINDOW"
+    ms=$(ms_since "$start")
+    bench_stop 1
+    printf '%-12s %s (%d ms)\n' "$1" "$(stats_line)" "$ms"
+}
+
+echo "fan-out: $SUBS suscriptores x $MSGS mensajes, ventana $WINDOW, SO_RCVBUF $RCVBUF"
+run "sin pacing" ""
+run "con pacing" "-p"
@@ -0,0 +1,30 @@
+#!/bin/sh
+# fanout_pipeline.sh: latencia de ingesta durante un fan-out grande, con y sin
+# pipeline ingesta/fan-out (-f).
+#
+# Para cada valor de WORKERS (0 = un solo bucle, sin pipeline) arranca un
+# broker, SUBS suscriptores en modo sumidero al tópico 'big' y un publisher en
+# modo carga a RATE msg/s durante DUR segundos. Cada publish genera SUBS
+# envíos; se imprimen el ritmo logrado y la latencia de ACK del publisher, que
+# con el pipeline no debería crecer con el fan-out.
+#
+# Uso: bench/fanout_pipeline.sh   (variables: BIN PORT WORKERS SUBS RATE SIZE DUR WINDOW)
+PORT=${PORT:-9580}
+WORKERS=${WORKERS:-"0 2"}
+SUBS=${SUBS:-32}
+RATE=${RATE:-2000}
+SIZE=${SIZE:-128}
+DUR=${DUR:-2}
+WINDOW=${WINDOW:-64}
+. "$(dirname "$0")/lib.sh"
+
+echo "fan-out de $SUBS suscriptores: publisher a $RATE msg/s, $SIZE B, $DUR s, ventana $WINDOW"
+for w in $WORKERS; do
+    fopt=""
+    [ "$w" -gt 0 ] && fopt="-f $w"
+    broker_start -w "$WINDOW" $fopt
+    subs_start "$SUBS" big -S 1000
+    pub_run big 0 -s "$SIZE" -R "$RATE" -T "$DUR" -w "$WINDOW"
+    bench_stop
+    printf 'workers %-2s %7s msg/s  %8s DATA repartidos  %s\n' "$w" "$(pub_rate)" "$(broker_stat data_tx)" "$(pub_lat)"
+done
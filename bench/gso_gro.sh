@@ -0,0 +1,30 @@
+#!/bin/sh
+# gso_gro.sh: fan-out del broker con y sin GSO/GRO (-g en broker y suscriptores).
+#
+# Lanza un broker, SUBS suscriptores y un publisher que envía MSGS mensajes con
+# ventana WINDOW. Con -g el broker agrupa los DATA consecutivos de cada
+# suscriptor en súper-buffers UDP_SEGMENT y los suscriptores leen con UDP_GRO.
+# Se imprimen las syscalls de envío por datagrama del broker, las lecturas por
+# mensaje de los suscriptores (media) y el tiempo del publisher.
+#
+# Uso: bench/gso_gro.sh   (variables: BIN PORT SUBS MSGS WINDOW)
+PORT=${PORT:-9490}
+SUBS=${SUBS:-8}
+MSGS=${MSGS:-5000}
+WINDOW=${WINDOW:-128}
+. "$(dirname "$0")/lib.sh"
+
+run() {   # $1 = etiqueta, $2 = flags de broker y suscriptores
+    broker_start -w "$WINDOW" $2
+    subs_start "$SUBS" bench $2
+    start=$(now_ns)
+    pub_run bench "$MSGS" -w "$WINDOW"
+    ms=$(ms_since "$start")
+    bench_stop
+    printf '%-8s envío: %s syscalls/datagrama  recepción: %s lecturas/msg  publisher %d ms\n' \
+        "$1" "$(broker_stat tx_syscalls/msg)" "$(subs_avg lecturas)" "$ms"
+}
+
+echo "gso/gro: $SUBS suscriptores x $MSGS mensajes, ventana $WINDOW"
+run "sin -g" ""
+run "con -g" "-g"
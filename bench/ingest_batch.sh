@@ -0,0 +1,31 @@
+#!/bin/sh
+# ingest_batch.sh: ingesta del broker con recvfrom() (-b 1) frente a recvmmsg().
+#
+# Lanza un broker sin suscriptores y PUBS publishers en paralelo que envían MSGS
+# mensajes cada uno con ventana WINDOW, de modo que el socket del broker acumula
+# datagramas entre vueltas del bucle de eventos. Para cada tamaño de lote se
+# imprimen las syscalls de lectura por mensaje (contador del broker) y la tasa
+# de ingesta (DATA recibidos / tiempo de pared).
+#
+# Uso: bench/ingest_batch.sh   (variables: BIN PORT PUBS MSGS WINDOW BATCHES)
+PORT=${PORT:-9450}
+PUBS=${PUBS:-8}
+MSGS=${MSGS:-20000}
+WINDOW=${WINDOW:-256}
+BATCHES=${BATCHES:-"1 8 64"}
+. "$(dirname "$0")/lib.sh"
+
+run() {   # $1 = tamaño de lote de recepción (-b)
+    broker_start -b "$1"
+    start=$(now_ns)
+    pubs_start "$PUBS" bench "$MSGS" -w "$WINDOW"
+    pubs_wait
+    ms=$(ms_since "$start")
+    bench_stop 0
+    rx=$(broker_stat data_rx)
+    printf 'lote_rx=%-3s syscalls/msg=%s  %d DATA en %d ms (%d msg/s)\n' "$1" "$(broker_stat rx_syscalls/msg)" \
+        "$rx" "$ms" $(( rx * 1000 / (ms ? ms : 1) ))
+}
+
+echo "ingesta: $PUBS publishers x $MSGS mensajes, ventana $WINDOW"
+for b in $BATCHES; do run "$b"; done
@@ -0,0 +1,128 @@
+# lib.sh: arnés común de los benchmarks. Cada script fija sus parámetros y lo
+# carga con
+#     . "$(dirname "$0")/lib.sh"
+# para arrancar y parar broker, suscriptores y publishers en 127.0.0.1:$PORT y
+# leer sus contadores. Los logs quedan en $TMP (se borra al salir):
+# broker.log, sub_<nombre>.log y pub.log / pub<i>.log.
+#
+#   broker_start [flags]            broker en $PORT (deja su pid en bpid)
+#   sub_start <nombre> <tópico> [flags]
+#   subs_start <n> <tópico> [flags] n suscriptores (nombres 0..n-1) y espera a que se registren
+#   pub_run <tópico> <msgs> [flags] publisher en primer plano
+#   pubs_start <n> <tópico> <msgs> [flags] / pubs_wait
+#   bench_stop [espera]             espera, SIGINT al broker (imprime sus stats) y a los
+#                                   suscriptores (imprimen sus contadores); PORT pasa al siguiente
+#   broker_stat <campo>             valor de <campo>= en las líneas de stats del broker
+#   sub_stat <nombre> <campo>       contador de la línea de salida de un suscriptor
+#   expect / expect_gt              aserciones de los benchmarks de corrección (ver bench_result)
+# Las variables internas llevan "_" delante para no pisar las de los scripts.
+BIN=${BIN:-build}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+bpid= spids= ppids= nsubs=0 bench_failed=0
+
+now_ns() { date +%s%N; }
+ms_since() { echo $(( ($(now_ns) - $1) / 1000000 )); }   # $1 = instante de now_ns
+
+broker_start() {
+    rm -f "$TMP"/sub_*.log
+    "$BIN/broker_quic" "$PORT" "$@" >"$TMP/broker.log" 2>&1 &
+    bpid=$!
+    sleep 0.2
+}
+
+sub_start() {   # $1 = nombre del log, $2 = tópico o filtro
+    _name=$1 _topic=$2
+    shift 2
+    "$BIN/subscriber_quic" 127.0.0.1 "$PORT" "$_topic" "$@" >"$TMP/sub_$_name.log" 2>&1 &
+    spids="$spids $!"
+}
+
+subs_start() {   # $1 = cuántos, $2 = tópico o filtro
+    _n=$1 _t=$2
+    shift 2
+    _i=0
+    while [ $_i -lt "$_n" ]; do
+        sub_start "$nsubs" "$_t" "$@"
+        nsubs=$((nsubs + 1))
+        _i=$((_i + 1))
+    done
+    sleep 0.5
+}
+
+pub_run() {   # $1 = tópico, $2 = mensajes
+    "$BIN/publisher_quic" 127.0.0.1 "$PORT" "$@" >"$TMP/pub.log" 2>&1
+}
+
+pubs_start() {   # $1 = cuántos, $2 = tópico, $3 = mensajes por publisher
+    _n=$1
+    shift
+    _i=0
+    while [ $_i -lt "$_n" ]; do
+        "$BIN/publisher_quic" 127.0.0.1 "$PORT" "$@" >"$TMP/pub$_i.log" 2>&1 &
+        ppids="$ppids $!"
+        _i=$((_i + 1))
+    done
+}
+pubs_wait() { wait $ppids; ppids=; }
+
+bench_stop() {
+    sleep "${1:-0.5}"
+    kill -INT $bpid; wait $bpid
+    kill -INT $spids 2>/dev/null; wait $spids 2>/dev/null
+    bpid= spids= nsubs=0
+    PORT=$((PORT + 1))
+}
+
+# --- Lectura de resultados ---
+broker_stat() { sed -n "s#.* $1=\([0-9.]*\).*#\1#p" "$TMP/broker.log" | head -n 1; }
+stats_line() { sed -n 's/.*stats: //p' "$TMP/broker.log"; }
+
+pub_rate() { sed -n 's/.*-> \([0-9]*\) msg\/s.*/\1/p' "$TMP/pub.log"; }
+pub_retx() { sed -n 's/.*(\([0-9.]*%\)).*/\1/p' "$TMP/pub.log"; }
+pub_lat()  { sed -n 's/.*latencia ACK: //p' "$TMP/pub.log"; }
+pub_p99()  { sed -n 's/.* p99=\([0-9.]* ms\).*/\1/p' "$TMP/pub.log"; }
+
+# Contadores de la salida del suscriptor: entregados, duplicados, reordenados,
+# perdidos, descartados (por el broker) y lecturas/msg.
+sub_stat() {   # $1 = nombre, $2 = contador
+    case $2 in
+        entregados)  _re='.* \([0-9]*\) entregados en orden.*' ;;
+        duplicados)  _re='.* \([0-9]*\) duplicados descartados.*' ;;
+        reordenados) _re='.* \([0-9]*\) reordenados.*' ;;
+        perdidos)    _re='.* \([0-9]*\) perdidos,.*' ;;
+        descartados) _re='.* \([0-9]*\) descartados por el broker.*' ;;
+        lecturas)    _re='.*(\([0-9.]*\) lecturas\/msg).*' ;;
+    esac
+    sed -n "s/$_re/\1/p" "$TMP/sub_$1.log"
+}
+
+# Media de un contador sobre todos los suscriptores de la ronda.
+subs_avg() {
+    for _f in "$TMP"/sub_*.log; do sub_stat "$(basename "$_f" .log | sed 's/^sub_//')" "$1"; done |
+        awk '{ s += $1 } END { if (NR) printf "%.3f", s / NR }'
+}
+
+# --- Aserciones ---
+expect() {   # $1 = descripción, $2 = obtenido, $3 = esperado
+    if [ "$2" = "$3" ]; then
+        printf '  ok     %s = %s\n' "$1" "$2"
+    else
+        printf '  FALLO  %s = %s (esperado %s)\n' "$1" "${2:-?}" "$3"
+        bench_failed=1
+    fi
+}
+expect_gt() {   # $1 = descripción, $2 = obtenido, $3 = cota inferior (exclusiva)
+    if [ -n "$2" ] && [ "$2" -gt "$3" ]; then
+        printf '  ok     %s = %s (> %s)\n' "$1" "$2" "$3"
+    else
+        printf '  FALLO  %s = %s (esperado > %s)\n' "$1" "${2:-?}" "$3"
+        bench_failed=1
+    fi
+}
+# Código de salida del script: 1 si falló alguna aserción.
+bench_result() {
+    [ "$bench_failed" -eq 0 ] && return 0
+    echo "FALLO: hay aserciones que no se cumplen" >&2
+    exit 1
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# pub_load.sh: capacidad del broker bajo carga sostenida del publisher (modo carga).
+#
+# Lanza un broker, SUBS suscriptores y, para cada ritmo de RATES, un publisher
+# en modo carga que envía mensajes de SIZE bytes durante DUR segundos con
+# ventana WINDOW (ritmo 0 = sin límite, lo que permita la ventana). Se
+# imprimen el ritmo logrado, las retransmisiones y los percentiles de la
+# latencia de ACK que informa el publisher.
+#
+# Uso: bench/pub_load.sh   (variables: BIN PORT SUBS SIZE DUR WINDOW RATES)
+PORT=${PORT:-9520}
+SUBS=${SUBS:-1}
+SIZE=${SIZE:-256}
+DUR=${DUR:-2}
+WINDOW=${WINDOW:-64}
+RATES=${RATES:-"10000 50000 0"}
+. "$(dirname "$0")/lib.sh"
+
+broker_start -w "$WINDOW"
+subs_start "$SUBS" bench -S 1000
+
+echo "carga del publisher: $SUBS suscriptores, $SIZE B, $DUR s, ventana $WINDOW"
+for r in $RATES; do
+    pub_run bench 0 -s "$SIZE" -R "$r" -T "$DUR" -w "$WINDOW"
+    printf 'objetivo %-7s logrado %7s msg/s  retx %-7s %s\n' "$r" "$(pub_rate)" "$(pub_retx)" "$(pub_lat)"
+done
+bench_stop 0
@@ -0,0 +1,28 @@
+#!/bin/sh
+# pub_scale.sh: techo de ingesta del broker con publishers multihilo (-N/-M).
+#
+# Lanza un broker y un suscriptor a 'bench/#' y, para cada número de hilos de
+# THREADS, un publisher con CONNS conexiones por hilo (una por tópico
+# bench/<k>) que envía mensajes de SIZE bytes sin límite de ritmo durante DUR
+# segundos. Se imprimen el ritmo confirmado, las retransmisiones y la latencia
+# de ACK; cuando el ritmo deja de crecer con los hilos se ha llegado al techo
+# del broker.
+#
+# Uso: bench/pub_scale.sh   (variables: BIN PORT THREADS CONNS SIZE DUR WINDOW)
+PORT=${PORT:-9540}
+THREADS=${THREADS:-"1 2 4"}
+CONNS=${CONNS:-4}
+SIZE=${SIZE:-128}
+DUR=${DUR:-2}
+WINDOW=${WINDOW:-32}
+. "$(dirname "$0")/lib.sh"
+
+broker_start -w "$WINDOW"
+subs_start 1 'bench/#' -S 1000
+
+echo "publishers multihilo: $CONNS conexiones/hilo, $SIZE B, $DUR s, ventana $WINDOW"
+for t in $THREADS; do
+    pub_run bench 0 -s "$SIZE" -T "$DUR" -w "$WINDOW" -N "$t" -M "$CONNS"
+    printf '%2d hilos x %d conexiones: %8s msg/s  retx %-8s p99 %s\n' "$t" "$CONNS" "$(pub_rate)" "$(pub_retx)" "$(pub_p99)"
+done
+bench_stop 0
@@ -9,8 +9,9 @@
 //  - Usa sockets UDP: la entrega de paquetes la hace el kernel, pero la fiabilidad
 //    y retransmisión las implementa este proceso en espacio de usuario (como QUIC).
 //  - Usa campos tipo/seq/ack en el header (similares a frames/packet numbers/ACKs).
-//  - Implementa un mecanismo de retransmisión con timeout (MQ_TIMEOUT_MS) y
-//    reintentos limitados (MQ_MAX_RETX) — comparable a un PTO + retransmisiones.
+//  - Implementa un mecanismo de retransmisión con timeout adaptativo (PTO a partir
+//    del RTT medido, MQ_TIMEOUT_MS sólo al principio) y reintentos limitados
+//    (MQ_MAX_RETX) — comparable a un PTO + retransmisiones.
 //  - Implementa ACKs explícitos (MQ_ACK) para confirmar recepción de paquetes.
 //
 // Limitaciones y diferencias importantes respecto a QUIC real:
@@ -20,35 +21,62 @@
 //  - No hay multiplexación real por streams; el "topic" es sólo un campo de mensaje
 //    a nivel de aplicación. QUIC soporta streams independientes dentro de la misma
 //    conexión evitando Head-of-Line blocking entre streams.
-//  - No hay control de congestión ni flow control (no CUBIC/BBR ni ventanas dinámicas).
-//  - No hay Connection IDs ni soporte de migración de path (no mobility).
-//  - El esquema de numeración de paquetes es simple (reutiliza seq entre publisher y
-//    subscribers), no se manejan envolturas/espacios de número de paquete múltiples.
+//  - Control de congestión por suscriptor (NewReno o CUBIC) que limita el fan-out;
+//    no hay flow control negociado con el receptor.
+//  - Connection IDs de 64 bits (header v2, bit 0x80 en type) elegidos por el cliente;
+//    la tabla de conexiones se indexa por CID y sigue a una conexión que cambia de
+//    dirección, pero no hay validación de path ni CIDs múltiples/rotación como en QUIC.
+//  - El esquema de numeración de paquetes es simple: un contador de 32 bits por
+//    conexión (el del publisher para sus DATA, uno propio del broker por suscriptor),
+//    sin espacios de número de paquete múltiples ni codificación truncada.
 //
 // Diferencia con "Lab 3" (enfoque tradicional):
 //  - Si Lab 3 usa TCP: allí la fiabilidad, orden y control de congestión las provee
 //    la pila TCP en kernel; aquí se implementa la lógica de fiabilidad en usuario
 //    sobre UDP (más parecido a la filosofía de QUIC).
 //  - Si Lab 3 usó UDP + capa didáctica de fiabilidad, este fichero es un ejemplo
-//    de esa idea aplicada a un broker pub/sub, con ACKs y retransmisiones, pero
-//    sin las características avanzadas de QUIC (TLS integrado, streams, CC).
+//    de esa idea aplicada a un broker pub/sub, con ACKs, retransmisiones y control
+//    de congestión por suscriptor, pero sin TLS integrado ni streams de QUIC.
 //
 // En las anotaciones abajo se explica cada sección/función con más detalle.
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103   // GSO: tamaño de segmento (linux/udp.h)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO     104   // GRO: recibir datagramas agregados
+#endif
+
+/* Estado de cada shard (opción -n): todo lo que modifica el bucle de eventos
+   (conexiones, tópicos, trie, rueda de timers, lotes de rx/tx, contadores) es
+   por hilo, así cada shard trabaja sin cerrojos. La configuración de main() es
+   global y de sólo lectura una vez arrancan los shards. */
+#define MQ_SHARD_LOCAL _Thread_local
 
 #define MQ_MAX_PAYLOAD 1200   // ACOTACIÓN práctica similar a MTU - caben en un datagrama UDP
-#define MQ_TIMEOUT_MS  500    // timeout para esperar ACKs (simula PTO simplificado)
+#define MQ_TIMEOUT_MS  500    // PTO inicial, mientras no hay muestras de RTT
 #define MQ_MAX_RETX    10     // número máximo de retransmisiones antes de fallar
 
 typedef enum {
@@ -57,9 +85,21 @@ typedef enum {
     MQ_SUB      = 3,
     MQ_PUB      = 4,
     MQ_DATA     = 5,
-    MQ_ACK      = 6
+    MQ_ACK      = 6,
+    MQ_FWD      = 7,    // broker -> suscriptor: hdr.ack = primer seq que aún puede llegar,
+                        // hdr.seq = DATA descartados por cola llena (acumulado)
+    MQ_RESET    = 8     // broker -> suscriptor: la conexión no existe (se cerró); volver a suscribirse
 } mq_type_t;
 
+/* Versión 2 del header: si el bit MQ_HDR_CID del type está activo, tras los
+   campos fijos va un Connection ID de 64 bits (orden de red). Como en QUIC, el
+   CID lo elige el cliente e identifica la conexión con independencia de la
+   dirección IP:port (sobrevive a un cambio de puerto/NAT). Los paquetes sin el
+   bit (versión 1) se siguen aceptando y su conexión se identifica por dirección. */
+#define MQ_HDR_CID   0x80
+#define MQ_TYPE_MASK 0x7f
+#define MQ_HDR_MAX   (sizeof(mq_hdr_t) + sizeof(uint64_t))
+
 #pragma pack(push, 1)
 // Header sencillo: type + seq (packet number) + ack (acknowledgement number)
 // topic_len + data_len para payload variable.
@@ -76,6 +116,7 @@ typedef struct {
 
 typedef struct {
     mq_hdr_t hdr;
+    uint64_t cid;                      // sólo si hdr.type lleva MQ_HDR_CID
     char     topic[128];               // campo de aplicación: topic (no es un "stream")
     uint8_t  data[MQ_MAX_PAYLOAD];
 } mq_packet_t;
@@ -83,26 +124,44 @@ typedef struct {
 // Ahora funciones auxiliares. Comentarios dentro explican el paralelo con QUIC.
 
 /* now_ms: tiempo en ms (usado para timeouts/retransmisiones)
-   En QUIC los timers (PTO, loss detection) son críticos; aquí usamos un timeout
-   simple para esperar ACKs después de enviar un paquete fiable. */
+   En QUIC los timers (PTO, loss detection) son críticos; aquí también: cada
+   paquete en vuelo vence a su PTO, que sale del RTT medido (ver mq_rtt_t).
+   Reloj monotónico: la rueda de timers no debe saltar si cambia la hora del sistema. */
 static uint64_t now_ms(void) {
     struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
     return (uint64_t)ts.tv_sec*1000ull + (uint64_t)(ts.tv_nsec/1000000ull);
 }
 
-/* mq_pack / mq_unpack: serialización básica de header + topic + data.
+/* now_us: igual que now_ms pero en microsegundos (ack_delay de los frames ACK). */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000ull + (uint64_t)(ts.tv_nsec/1000ull);
+}
+
+/* mq_pack / mq_parse: serialización básica de header + topic + data.
    QUIC define formatos binarios y frames (STREAM, ACK, CRYPTO, etc.). Este
    mini-protocolo tiene tipos similares (MQ_DATA ~ STREAM frame, MQ_ACK ~ ACK). */
+static void put_u64(uint8_t* b, uint64_t v) { for (int i=7;i>=0;i--) { b[i] = (uint8_t)v; v >>= 8; } }
+static uint64_t get_u64(const uint8_t* b) { uint64_t v = 0; for (int i=0;i<8;i++) v = v << 8 | b[i]; return v; }
+
+// Cabecera (y CID si type lleva MQ_HDR_CID) en orden de red; devuelve los bytes escritos (<= MQ_HDR_MAX).
+static size_t mq_hdr_encode(uint8_t* buf, const mq_hdr_t* h, uint64_t cid) {
+    mq_hdr_t w = *h;
+    w.seq       = htonl(h->seq);
+    w.ack       = htonl(h->ack);
+    w.topic_len = htons(h->topic_len);
+    w.data_len  = htons(h->data_len);
+    memcpy(buf, &w, sizeof(w));
+    if (!(h->type & MQ_HDR_CID)) return sizeof(w);
+    put_u64(buf + sizeof(w), cid);
+    return sizeof(w) + sizeof(cid);
+}
+
 static size_t mq_pack(uint8_t* buf, size_t buflen, const mq_packet_t* p) {
-    if (buflen < sizeof(mq_hdr_t)) return 0;
-    mq_hdr_t h = p->hdr;
-    h.seq       = htonl(h.seq);
-    h.ack       = htonl(h.ack);
-    h.topic_len = htons(h.topic_len);
-    h.data_len  = htons(h.data_len);
-    memcpy(buf, &h, sizeof(h));
-    size_t off = sizeof(h);
+    if (buflen < MQ_HDR_MAX) return 0;
+    size_t off = mq_hdr_encode(buf, &p->hdr, p->cid);
     if (p->hdr.topic_len) {
         if (off + p->hdr.topic_len > buflen) return 0;
         memcpy(buf+off, p->topic, p->hdr.topic_len);
@@ -116,174 +175,1977 @@ static size_t mq_pack(uint8_t* buf, size_t buflen, const mq_packet_t* p) {
     return off;
 }
 
-static bool mq_unpack(const uint8_t* buf, size_t len, mq_packet_t* out) {
+/* mq_view_t: vista de un datagrama recibido. mq_parse() valida la cabecera y
+   las longitudes y deja topic/data apuntando al propio buffer de recepción:
+   ni el topic ni el payload se copian (el topic NO termina en '\0', usar
+   hdr.topic_len). La vista vale mientras el buffer no se reutilice. */
+typedef struct {
+    mq_hdr_t       hdr;     // cabecera en orden de host (type sin el bit MQ_HDR_CID)
+    bool           has_cid;
+    uint64_t       cid;
+    const char*    topic;   // topic_len bytes dentro del datagrama
+    const uint8_t* data;    // data_len bytes dentro del datagrama
+} mq_view_t;
+
+static bool mq_parse(const uint8_t* buf, size_t len, mq_view_t* v) {
     if (len < sizeof(mq_hdr_t)) return false;
-    memcpy(&out->hdr, buf, sizeof(mq_hdr_t));
-    out->hdr.seq       = ntohl(out->hdr.seq);
-    out->hdr.ack       = ntohl(out->hdr.ack);
-    out->hdr.topic_len = ntohs(out->hdr.topic_len);
-    out->hdr.data_len  = ntohs(out->hdr.data_len);
+    memcpy(&v->hdr, buf, sizeof(mq_hdr_t));
+    v->hdr.seq       = ntohl(v->hdr.seq);
+    v->hdr.ack       = ntohl(v->hdr.ack);
+    v->hdr.topic_len = ntohs(v->hdr.topic_len);
+    v->hdr.data_len  = ntohs(v->hdr.data_len);
     size_t off = sizeof(mq_hdr_t);
-    if (out->hdr.topic_len) {
-        if (off + out->hdr.topic_len > len || out->hdr.topic_len >= sizeof(out->topic)) return false;
-        memcpy(out->topic, buf+off, out->hdr.topic_len);
-        out->topic[out->hdr.topic_len] = '\0';
-        off += out->hdr.topic_len;
-    } else out->topic[0] = '\0';
-    if (out->hdr.data_len) {
-        if (off + out->hdr.data_len > len || out->hdr.data_len > MQ_MAX_PAYLOAD) return false;
-        memcpy(out->data, buf+off, out->hdr.data_len);
+    v->has_cid = v->hdr.type & MQ_HDR_CID;
+    v->hdr.type &= MQ_TYPE_MASK;
+    v->cid = 0;
+    if (v->has_cid) {
+        if (len < off + sizeof(uint64_t)) return false;
+        v->cid = get_u64(buf + off);
+        off += sizeof(uint64_t);
     }
+    if (v->hdr.topic_len >= sizeof(((mq_packet_t*)0)->topic) || off + v->hdr.topic_len > len) return false;
+    v->topic = (const char*)buf + off;
+    off += v->hdr.topic_len;
+    if (v->hdr.data_len > MQ_MAX_PAYLOAD || off + v->hdr.data_len > len) return false;
+    v->data = buf + off;
     return true;
 }
 
-/* mq_send_ack: construye y envía un paquete MQ_ACK.
-   En QUIC los ACKs son frames que pueden piggybackearse o enviarse separados.
-   Aquí simplificamos: enviamos un UDP datagrama con tipo MQ_ACK y campo ack. */
-static int mq_send_ack(int sock, const struct sockaddr_in* a, socklen_t alen, uint32_t acknum) {
+/* --- Frames ACK con rangos (estilo QUIC) ---
+   Un MQ_ACK ya no está limitado a un único número: en el campo data lleva
+       ack_delay_us (u32) | n (u8) | first_len (u32) | (n-1) x { gap (u32), len (u32) }
+   en orden de red, y hdr.ack = mayor seq confirmado ("largest"). El primer rango
+   es [largest-first_len, largest]; cada rango siguiente empieza 'gap' seqs
+   ausentes por debajo del anterior y cubre len+1 seqs. Así un solo datagrama
+   confirma decenas de paquetes, y los huecos le dicen al emisor qué se perdió
+   sin esperar al timeout. ack_delay_us es el tiempo que el receptor retuvo el
+   ACK desde que llegó 'largest' (QUIC lo descuenta al medir el RTT).
+   Un MQ_ACK con data_len == 0 sigue siendo el ACK simple del header. */
+#define MQ_ACK_MAX_RANGES 32
+
+typedef struct { uint32_t lo, hi; } mq_range_t;   // rango cerrado [lo, hi]
+
+// Conjunto de seqs recibidos: rangos disjuntos, no contiguos, en orden descendente.
+typedef struct {
+    int        n;
+    mq_range_t r[MQ_ACK_MAX_RANGES];
+} mq_rangeset_t;
+
+typedef struct {
+    uint32_t      ack_delay_us;
+    mq_rangeset_t rs;
+} mq_ackframe_t;
+
+static bool rs_contains(const mq_rangeset_t* rs, uint32_t seq) {
+    for (int i=0;i<rs->n;i++) {
+        if (seq > rs->r[i].hi) return false;
+        if (seq >= rs->r[i].lo) return true;
+    }
+    return false;
+}
+
+/* rs_add: inserta seq fusionando con rangos vecinos. Si el conjunto está lleno
+   se olvida el rango más viejo (el más bajo), como hace QUIC al limitar rangos. */
+static void rs_add(mq_rangeset_t* rs, uint32_t seq) {
+    int i = 0;
+    for (; i<rs->n; i++) {
+        mq_range_t* r = &rs->r[i];
+        if (seq > r->hi) {
+            if (seq == r->hi + 1) { r->hi = seq; return; }
+            break;                                  // va como rango nuevo en la posición i
+        }
+        if (seq >= r->lo) return;                   // ya estaba
+        if (seq == r->lo - 1) {
+            r->lo = seq;
+            if (i+1 < rs->n && rs->r[i+1].hi == seq - 1) {  // tapa el hueco: fusionar
+                r->lo = rs->r[i+1].lo;
+                memmove(&rs->r[i+1], &rs->r[i+2], (size_t)(rs->n - i - 2) * sizeof(mq_range_t));
+                rs->n--;
+            }
+            return;
+        }
+    }
+    if (i == MQ_ACK_MAX_RANGES) return;             // más viejo que todo lo que cabe
+    int n = rs->n < MQ_ACK_MAX_RANGES ? rs->n : MQ_ACK_MAX_RANGES - 1;
+    memmove(&rs->r[i+1], &rs->r[i], (size_t)(n - i) * sizeof(mq_range_t));
+    rs->r[i].lo = rs->r[i].hi = seq;
+    rs->n = n + 1;
+}
+
+static void put_u32(uint8_t* b, uint32_t v) { v = htonl(v); memcpy(b, &v, 4); }
+static uint32_t get_u32(const uint8_t* b) { uint32_t v; memcpy(&v, b, 4); return ntohl(v); }
+
+static size_t mq_ack_encode(uint8_t* b, size_t bl, const mq_ackframe_t* f) {
+    size_t need = 4 + 1 + 4 + (size_t)(f->rs.n - 1) * 8;
+    if (f->rs.n < 1 || need > bl) return 0;
+    put_u32(b, f->ack_delay_us);
+    b[4] = (uint8_t)f->rs.n;
+    put_u32(b+5, f->rs.r[0].hi - f->rs.r[0].lo);
+    size_t off = 9;
+    for (int i=1;i<f->rs.n;i++) {
+        put_u32(b+off,   f->rs.r[i-1].lo - f->rs.r[i].hi - 1);
+        put_u32(b+off+4, f->rs.r[i].hi - f->rs.r[i].lo);
+        off += 8;
+    }
+    return off;
+}
+
+/* mq_ack_parse: extrae el frame de un MQ_ACK (con rangos o simple). */
+static bool mq_ack_parse(const mq_view_t* p, mq_ackframe_t* f) {
+    if (p->hdr.type != MQ_ACK) return false;
+    if (!p->hdr.data_len) {
+        f->ack_delay_us = 0;
+        f->rs.n = 1; f->rs.r[0].lo = f->rs.r[0].hi = p->hdr.ack;
+        return true;
+    }
+    const uint8_t* b = p->data;
+    size_t len = p->hdr.data_len;
+    if (len < 9) return false;
+    int n = b[4];
+    if (n < 1 || n > MQ_ACK_MAX_RANGES || len < 9 + (size_t)(n-1)*8) return false;
+    f->ack_delay_us = get_u32(b);
+    uint32_t hi = p->hdr.ack, span = get_u32(b+5);
+    if (span > hi) return false;
+    f->rs.r[0].hi = hi; f->rs.r[0].lo = hi - span;
+    for (int i=1;i<n;i++) {
+        uint32_t gap = get_u32(b+9+(i-1)*8), l = get_u32(b+13+(i-1)*8);
+        uint32_t prev_lo = f->rs.r[i-1].lo;
+        if (gap >= prev_lo) return false;
+        hi = prev_lo - gap - 1;
+        if (l > hi) return false;
+        f->rs.r[i].hi = hi; f->rs.r[i].lo = hi - l;
+    }
+    f->rs.n = n;
+    return true;
+}
+
+/* mq_send_ack: construye y envía un paquete MQ_ACK con los rangos del frame.
+   En QUIC los ACKs son frames que pueden piggybackearse o enviarse separados;
+   aquí van siempre en su propio datagrama UDP. */
+static int mq_send_ack(int sock, const struct sockaddr_in* a, socklen_t alen, const uint64_t* cid,
+                       const mq_ackframe_t* f) {
     mq_packet_t p = {0};
     p.hdr.type = MQ_ACK;
-    p.hdr.ack  = acknum;
-    uint8_t b[64];
+    if (cid) { p.hdr.type |= MQ_HDR_CID; p.cid = *cid; }
+    p.hdr.ack  = f->rs.r[0].hi;
+    p.hdr.data_len = (uint16_t)mq_ack_encode(p.data, sizeof(p.data), f);
+    if (!p.hdr.data_len) return -1;
+    uint8_t b[1600];
     size_t n = mq_pack(b, sizeof(b), &p);
     return (sendto(sock, b, n, 0, (const struct sockaddr*)a, alen) < 0) ? -1 : 0;
 }
 
-/* mq_send_reliable: envía un paquete y espera ACK con retransmisiones:
-   - Envía datagrama UDP con los bytes serializados.
-   - Espera por un MQ_ACK con 'ack == seq' usando select() con timeout.
-   - Reintenta hasta MQ_MAX_RETX.
-   Esto reproduce la idea de fiabilidad en espacio de usuario (como QUIC),
-   aunque QUIC tiene lógica avanzada de pérdida y timers más complejos. */
-static int mq_send_reliable(int sock, const struct sockaddr_in* a, socklen_t alen, mq_packet_t* p) {
-    uint8_t buf[1600];
-    size_t n = mq_pack(buf, sizeof(buf), p);
-    if (!n) return -1;
-    int tries = 0;
-    while (tries < MQ_MAX_RETX) {
-        if (sendto(sock, buf, n, 0, (const struct sockaddr*)a, alen) < 0) {
-            perror("sendto"); return -1;
+/* --- Estimación de RTT y PTO adaptativo (RFC 9002 §5-6) ---
+   Un timeout fijo de 500 ms es ~1000 veces el RTT de loopback/LAN: una pérdida
+   congelaba el flujo medio segundo. Por peer se lleva:
+     - latest/min_rtt: última muestra y mínima observada,
+     - srtt/rttvar: media y variación suavizadas (7/8 y 3/4, como TCP/QUIC),
+     - max_ack_delay: mayor retención de ACK que el peer ha reportado.
+   Las muestras salen de ACKs de paquetes enviados una sola vez (algoritmo de
+   Karn: con retransmisiones no se sabe a qué envío corresponde el ACK), y se
+   les descuenta el ack_delay reportado. PTO = srtt + max(4*rttvar, 1 ms) +
+   max_ack_delay, duplicado por cada PTO consecutivo sin respuesta. */
+#define MQ_GRANULARITY_US    1000  // resolución mínima del timer
+#define MQ_MAX_ACK_DELAY_MS  25    // ack_delay supuesto del peer hasta que reporte otro
+#define MQ_MAX_PTO_MS        4000  // tope del PTO con backoff
+
+typedef struct {
+    uint64_t latest_us, min_rtt_us, srtt_us, rttvar_us;
+    uint64_t max_ack_delay_us;
+    bool     has_sample;
+    int      pto_count;   // PTOs consecutivos sin ACK nuevo (backoff exponencial)
+} mq_rtt_t;
+
+static void rtt_init(mq_rtt_t* r) {
+    memset(r, 0, sizeof(*r));
+    r->max_ack_delay_us = MQ_MAX_ACK_DELAY_MS * 1000ull;
+}
+
+static void rtt_on_sample(mq_rtt_t* r, uint64_t sample_us, uint64_t ack_delay_us) {
+    if (ack_delay_us > r->max_ack_delay_us && ack_delay_us < MQ_MAX_PTO_MS * 1000ull)
+        r->max_ack_delay_us = ack_delay_us;
+    r->latest_us = sample_us;
+    if (!r->has_sample || sample_us < r->min_rtt_us) r->min_rtt_us = sample_us;
+    if (!r->has_sample) {
+        r->srtt_us = sample_us;
+        r->rttvar_us = sample_us / 2;
+        r->has_sample = true;
+        return;
+    }
+    // No descontar el ack_delay si eso dejara la muestra por debajo de min_rtt.
+    uint64_t adj = sample_us;
+    if (adj >= r->min_rtt_us + ack_delay_us) adj -= ack_delay_us;
+    uint64_t dev = r->srtt_us > adj ? r->srtt_us - adj : adj - r->srtt_us;
+    r->rttvar_us = (3 * r->rttvar_us + dev) / 4;
+    r->srtt_us = (7 * r->srtt_us + adj) / 8;
+}
+
+static uint64_t rtt_pto_ms(const mq_rtt_t* r) {
+    uint64_t pto_us = MQ_TIMEOUT_MS * 1000ull;
+    if (r->has_sample) {
+        uint64_t var = 4 * r->rttvar_us;
+        pto_us = r->srtt_us + (var > MQ_GRANULARITY_US ? var : MQ_GRANULARITY_US) + r->max_ack_delay_us;
+    }
+    pto_us <<= (r->pto_count < 16 ? r->pto_count : 16);
+    uint64_t ms = (pto_us + 999) / 1000;
+    return ms < MQ_MAX_PTO_MS ? ms : MQ_MAX_PTO_MS;
+}
+
+/* --- Control de congestión por peer ---
+   Sin noción de la capacidad del camino, una ventana grande inunda al suscriptor
+   (o el buffer del propio socket) y cada pérdida dispara más retransmisiones.
+   Cada suscriptor tiene un mq_cc_t con su cwnd en bytes, que limita cuántos
+   bytes pueden estar en vuelo además de la ventana fija (-w). El algoritmo es
+   enchufable (mq_cc_ops_t, opción -c):
+     - NewReno (RFC 9002 §7): slow start, +1 MSS por RTT en evitación de
+       congestión y cwnd/2 ante pérdida.
+     - CUBIC (RFC 9438): crecimiento W(t) = C(t-K)^3 + W_max alrededor de la
+       ventana en la que hubo pérdida, beta = 0.7, convergencia rápida y
+       estimación "Reno-friendly" para RTTs cortos.
+   Una pérdida (por umbral de paquetes o PTO) sólo reduce cwnd una vez por
+   episodio: los envíos anteriores al inicio de la recuperación (recovery_tx) no
+   cuentan de nuevo. MQ_CC_PERSISTENT PTOs seguidos equivalen a congestión
+   persistente y dejan cwnd en el mínimo. */
+#define MQ_CC_MSS          1200                // tamaño de datagrama de referencia
+#define MQ_CC_INITIAL_WND  (10 * MQ_CC_MSS)
+#define MQ_CC_MIN_WND      (2 * MQ_CC_MSS)
+#define MQ_CC_PERSISTENT   3
+#define MQ_CUBIC_C         0.4
+#define MQ_CUBIC_BETA      0.7
+
+typedef struct mq_cc mq_cc_t;
+
+typedef struct {
+    const char* name;
+    void (*on_ack)(mq_cc_t* cc, size_t bytes, uint64_t now_us, const mq_rtt_t* rtt);
+    void (*on_congestion)(mq_cc_t* cc);
+} mq_cc_ops_t;
+
+struct mq_cc {
+    const mq_cc_ops_t* ops;
+    uint64_t cwnd, ssthresh;       // bytes
+    uint64_t bytes_in_flight;
+    uint64_t recovery_tx;          // tx <= recovery_tx: enviado antes de la última reducción
+    double   w_max, k, w_est;      // CUBIC, en MSS
+    uint64_t epoch_us;             // CUBIC: inicio de la época de crecimiento (0 = ninguna)
+};
+
+static void reno_on_ack(mq_cc_t* cc, size_t bytes, uint64_t now_us, const mq_rtt_t* rtt) {
+    (void)now_us; (void)rtt;
+    if (cc->cwnd < cc->ssthresh) cc->cwnd += bytes;                 // slow start
+    else cc->cwnd += (uint64_t)MQ_CC_MSS * bytes / cc->cwnd;        // +1 MSS por RTT
+}
+
+static void reno_on_congestion(mq_cc_t* cc) {
+    cc->ssthresh = cc->cwnd / 2 > MQ_CC_MIN_WND ? cc->cwnd / 2 : MQ_CC_MIN_WND;
+    cc->cwnd = cc->ssthresh;
+}
+
+static void cubic_on_ack(mq_cc_t* cc, size_t bytes, uint64_t now_us, const mq_rtt_t* rtt) {
+    if (cc->cwnd < cc->ssthresh) { cc->cwnd += bytes; return; }    // slow start
+    double w = (double)cc->cwnd / MQ_CC_MSS;
+    if (!cc->epoch_us) {
+        cc->epoch_us = now_us;
+        if (cc->w_max < w) { cc->w_max = w; cc->k = 0; }            // sin pérdida previa: meseta en w
+        cc->w_est = w;
+    }
+    double t = (double)(now_us - cc->epoch_us + rtt->srtt_us) / 1e6;
+    double target = MQ_CUBIC_C * (t - cc->k) * (t - cc->k) * (t - cc->k) + cc->w_max;
+    cc->w_est += 3.0 * (1 - MQ_CUBIC_BETA) / (1 + MQ_CUBIC_BETA) * ((double)bytes / MQ_CC_MSS) / w;
+    if (cc->w_est > target) target = cc->w_est;
+    if (target > 1.5 * w) target = 1.5 * w;
+    if (target > w) cc->cwnd += (uint64_t)((target - w) / w * (double)bytes);
+}
+
+static void cubic_on_congestion(mq_cc_t* cc) {
+    double w = (double)cc->cwnd / MQ_CC_MSS;
+    // Convergencia rápida: si la pérdida llega antes de recuperar W_max, ceder ancho de banda.
+    cc->w_max = w < cc->w_max ? w * (1 + MQ_CUBIC_BETA) / 2 : w;
+    cc->k = cbrt(cc->w_max * (1 - MQ_CUBIC_BETA) / MQ_CUBIC_C);
+    uint64_t ss = (uint64_t)(cc->cwnd * MQ_CUBIC_BETA);
+    cc->ssthresh = ss > MQ_CC_MIN_WND ? ss : MQ_CC_MIN_WND;
+    cc->cwnd = cc->ssthresh;
+    cc->epoch_us = 0;
+}
+
+static const mq_cc_ops_t mq_cc_newreno = { "newreno", reno_on_ack,  reno_on_congestion  };
+static const mq_cc_ops_t mq_cc_cubic   = { "cubic",   cubic_on_ack, cubic_on_congestion };
+
+static void cc_init(mq_cc_t* cc, const mq_cc_ops_t* ops) {
+    memset(cc, 0, sizeof(*cc));
+    cc->ops = ops;
+    cc->cwnd = MQ_CC_INITIAL_WND;
+    cc->ssthresh = UINT64_MAX;
+}
+
+// Siempre se permite un paquete si no hay nada en vuelo, para no bloquear el camino.
+static bool cc_can_send(const mq_cc_t* cc, size_t len) {
+    return !cc->bytes_in_flight || cc->bytes_in_flight + len <= cc->cwnd;
+}
+
+static void cc_on_acked(mq_cc_t* cc, size_t len, uint64_t tx, uint64_t now_us, const mq_rtt_t* rtt) {
+    if (tx <= cc->recovery_tx) return;     // en recuperación no se crece
+    cc->ops->on_ack(cc, len, now_us, rtt);
+}
+
+// Evento de pérdida del envío 'tx'; last_tx = último tx usado en este camino.
+static void cc_on_lost(mq_cc_t* cc, uint64_t tx, uint64_t last_tx) {
+    if (tx <= cc->recovery_tx) return;     // mismo episodio: ya se redujo
+    cc->recovery_tx = last_tx;
+    cc->ops->on_congestion(cc);
+}
+
+static void cc_on_persistent_congestion(mq_cc_t* cc) {
+    cc->cwnd = MQ_CC_MIN_WND;
+    cc->epoch_us = 0;
+}
+
+/* --- Rueda de timers jerárquica ---
+   Guarda todos los vencimientos de retransmisión pendientes. Resolución de 1 ms,
+   MQ_TW_LEVELS niveles de 64 ranuras (horizonte ~4.6 h). Insertar y cancelar
+   son O(1) (listas doblemente enlazadas); al avanzar, cuando el nivel 0 da la
+   vuelta se "cascadea" la ranura correspondiente del nivel superior, como la
+   rueda clásica del kernel Linux. Un stack QUIC real usa una estructura parecida
+   para sus timers de pérdida/PTO con miles de paquetes en vuelo. */
+#define MQ_TW_BITS    6
+#define MQ_TW_SIZE    (1u << MQ_TW_BITS)
+#define MQ_TW_MASK    (MQ_TW_SIZE - 1)
+#define MQ_TW_LEVELS  4
+
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+typedef struct mq_timer {
+    struct mq_timer* next;
+    struct mq_timer* prev;
+    uint64_t expires;   // instante absoluto (ms) de vencimiento
+    void   (*fn)(int sock, struct mq_timer* t, uint64_t now);
+} mq_timer_t;
+
+typedef struct {
+    mq_timer_t slots[MQ_TW_LEVELS][MQ_TW_SIZE];  // centinelas de listas circulares
+    uint64_t   base;    // próximo tick (ms) a procesar
+    size_t     count;   // timers armados
+} mq_wheel_t;
+static MQ_SHARD_LOCAL mq_wheel_t wheel;
+
+static void tw_init(uint64_t now) {
+    for (int l=0;l<MQ_TW_LEVELS;l++) for (unsigned i=0;i<MQ_TW_SIZE;i++)
+        wheel.slots[l][i].next = wheel.slots[l][i].prev = &wheel.slots[l][i];
+    wheel.base = now;
+    wheel.count = 0;
+}
+
+static bool tw_armed(const mq_timer_t* t) { return t->next != NULL; }
+
+static void tw_link(mq_timer_t* t) {
+    uint64_t e = t->expires < wheel.base ? wheel.base : t->expires;
+    uint64_t delta = e - wheel.base;
+    int l = 0;
+    while (l < MQ_TW_LEVELS-1 && delta >= (1ull << (MQ_TW_BITS*(l+1)))) l++;
+    if (delta >= (1ull << (MQ_TW_BITS*MQ_TW_LEVELS))) e = wheel.base + (1ull << (MQ_TW_BITS*MQ_TW_LEVELS)) - 1;
+    mq_timer_t* head = &wheel.slots[l][(e >> (MQ_TW_BITS*l)) & MQ_TW_MASK];
+    t->next = head; t->prev = head->prev;
+    head->prev->next = t; head->prev = t;
+}
+
+static void tw_cancel(mq_timer_t* t) {
+    if (!tw_armed(t)) return;
+    t->prev->next = t->next; t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    wheel.count--;
+}
+
+static void tw_schedule(mq_timer_t* t, uint64_t expires) {
+    tw_cancel(t);
+    t->expires = expires;
+    tw_link(t);
+    wheel.count++;
+}
+
+// Reinserta la ranura 'idx' del nivel 'l' (sus timers caen a niveles inferiores).
+static unsigned tw_cascade(int l, unsigned idx) {
+    mq_timer_t* head = &wheel.slots[l][idx];
+    mq_timer_t* t = head->next;
+    head->next = head->prev = head;
+    while (t != head) { mq_timer_t* nx = t->next; tw_link(t); t = nx; }
+    return idx;
+}
+
+// Procesa todos los ticks hasta 'now' inclusive, disparando los timers vencidos.
+static void tw_advance(int sock, uint64_t now) {
+    if (!wheel.count) { if (now >= wheel.base) wheel.base = now + 1; return; }
+    while (wheel.base <= now) {
+        unsigned idx = wheel.base & MQ_TW_MASK;
+        for (int l=1; l<MQ_TW_LEVELS && idx==0; l++)
+            idx = tw_cascade(l, (wheel.base >> (MQ_TW_BITS*l)) & MQ_TW_MASK);
+        mq_timer_t* head = &wheel.slots[0][wheel.base & MQ_TW_MASK];
+        wheel.base++;
+        while (head->next != head) {
+            mq_timer_t* t = head->next;
+            tw_cancel(t);
+            t->fn(sock, t, now);   // el callback puede re-armar el timer
         }
-        uint64_t start = now_ms();
-        for (;;) {
-            uint64_t elapsed = now_ms() - start;
-            if (elapsed >= MQ_TIMEOUT_MS) break; // timeout -> volver a retransmitir
-            struct timeval tv = { .tv_sec = (MQ_TIMEOUT_MS - elapsed)/1000,
-                                  .tv_usec = ((MQ_TIMEOUT_MS - elapsed)%1000)*1000 };
-            fd_set fds; FD_ZERO(&fds); FD_SET(sock, &fds);
-            int r = select(sock+1, &fds, NULL, NULL, &tv);
-            if (r > 0 && FD_ISSET(sock, &fds)) {
-                uint8_t rbuf[1600];
-                struct sockaddr_in f; socklen_t fl = sizeof(f);
-                ssize_t rn = recvfrom(sock, rbuf, sizeof(rbuf), 0, (struct sockaddr*)&f, &fl);
-                if (rn > 0) {
-                    mq_packet_t ap;
-                    // Si recibimos el ACK para este seq, devolvemos éxito.
-                    if (mq_unpack(rbuf, rn, &ap) && ap.hdr.type==MQ_ACK && ap.hdr.ack==p->hdr.seq) return 0;
-                }
-            } else if (r < 0 && errno != EINTR) { perror("select"); break; }
+    }
+}
+
+/* Milisegundos hasta el próximo tick con trabajo (-1 si no hay timers): es el
+   timeout de epoll_wait(). Si el nivel 0 está vacío se despierta en el próximo
+   punto de cascada, que como mucho ocurre cada 64 ms. */
+static int tw_next_timeout(uint64_t now) {
+    if (!wheel.count) return -1;
+    if (wheel.base > now + MQ_TW_SIZE) return MQ_TW_SIZE;
+    uint64_t left = wheel.base > now ? wheel.base - now : 0;
+    unsigned start = wheel.base & MQ_TW_MASK;
+    for (unsigned i=0;i<MQ_TW_SIZE;i++) {
+        unsigned idx = (start + i) & MQ_TW_MASK;
+        if (i && idx == 0) break;   // al dar la vuelta toca cascada
+        if (wheel.slots[0][idx].next != &wheel.slots[0][idx]) return (int)(left + i);
+    }
+    return (int)(left + (MQ_TW_SIZE - start));
+}
+
+/* --- Suscriptores ---
+   Un suscriptor es una "conexión" de la tabla de conexiones, identificada como
+   en QUIC por su Connection ID (o por su dirección IP:port si el cliente habla
+   la versión 1 del header, sin CID; ver conn_key). Puede tener varias suscripciones (tópicos o
+   filtros) y lleva su propio estado de envío (cola de DATA pendientes de ACK):
+   así un suscriptor lento o caído no bloquea al resto.
+   Los DATA hacia cada suscriptor se numeran en un espacio de seq propio
+   (1, 2, 3...), independiente del seq que usó el publisher: dos publishers en
+   un mismo tópico no colisionan y el suscriptor ve una secuencia contigua en
+   la que cualquier hueco es una pérdida real (sus ACK con rangos la delatan).
+   Un DATA descartado porque la cola está llena no llega a tener seq, así que
+   no abre hueco: el total por suscriptor se le anuncia en el MQ_FWD (cuando
+   cambia, como mucho uno cada MQ_DROP_LOG_MS o al vaciarse la cola). */
+#define MQ_SUB_QUEUE_MAX  1024  // DATA encolados por suscriptor antes de descartar
+#define MQ_DROP_LOG_MS    1000  // como mucho un aviso de cola llena por suscriptor y segundo
+#define MQ_DEFAULT_WINDOW 32    // paquetes en vuelo por suscriptor (opción -w)
+#define MQ_PKT_THRESHOLD  3     // reordenamiento tolerado antes de dar un paquete por perdido
+#define MQ_IDLE_TIMEOUT_MS 30000  // conexión sin suscripciones ni tráfico: se da de baja
+#define MQ_CONN_MAX_FAILS 3     // entregas abandonadas seguidas antes de dar de baja a un suscriptor
+
+#define MQ_PACING_GAIN    1.25  // ritmo = 1.25 * cwnd / srtt (como QUIC, RFC 9002 §7.7)
+#define MQ_SUBF_PACING    0x01  // flag en el data de un SUB: el suscriptor pide pacing
+
+static int send_window = MQ_DEFAULT_WINDOW;
+static const mq_cc_ops_t* cc_algo = &mq_cc_cubic;   // opción -c
+static bool pacing_default = false;                  // opción -p: pacing para todos
+static bool verbose = false;                         // opción -v: traza por DATA entregado
+
+/* Contadores del broker; se imprimen al terminar (SIGINT/SIGTERM). data_tx
+   cuenta sólo primeros envíos, así que la tasa de pérdida estimada es la parte
+   de los envíos que fueron retransmisiones: retx / (data_tx + retx), nunca más
+   del 100%. 'dropped' cuenta todos los DATA que un suscriptor no recibirá
+   (agotaron MQ_MAX_RETX o su cola estaba llena); 'qdrop' es la parte debida a
+   la cola llena. */
+typedef struct {
+    unsigned long data_rx, data_tx, retx, fast_retx, pto, dropped, paced;
+    unsigned long qdrop;                 // DATA descartados por cola de suscriptor llena
+    unsigned long dup_rx;                // DATA de publishers repetidos (confirmados, no repartidos)
+    unsigned long old_rx;                // DATA más viejos que la ventana anti-duplicados (ni confirmados ni repartidos)
+    unsigned long rx_dgrams, rx_calls;   // ingesta: datagramas leídos / syscalls de lectura
+    unsigned long tx_dgrams, tx_calls;   // fan-out: datagramas enviados / syscalls de envío
+    unsigned long xfwd, xdrop;           // -n/-f: publish pasados a otro hilo / perdidos por su cola llena
+    unsigned long closed;                // conexiones dadas de baja (inactivas o sin respuesta)
+} mq_stats_t;
+static MQ_SHARD_LOCAL mq_stats_t stats;
+
+struct mq_conn;
+struct mq_topic;
+
+/* Cuerpo (topic + data) de un DATA entrante, serializado una sola vez y
+   compartido por las colas de todos los suscriptores y por el vector de envío.
+   Cada referencia (mq_outmsg_t, entrada de tx pendiente o mensaje entre
+   shards) suma uno a refs; es atómico porque con -n varios shards lo sueltan. */
+typedef struct mq_payload {
+    atomic_uint refs;
+    size_t   len;
+    uint8_t  buf[];
+} mq_payload_t;
+
+static mq_payload_t* payload_new(const char* topic, size_t tl, const uint8_t* data, size_t dl) {
+    mq_payload_t* pl = malloc(sizeof(*pl) + tl + dl);
+    if (!pl) { perror("malloc"); return NULL; }
+    atomic_init(&pl->refs, 1);
+    pl->len = tl + dl;
+    memcpy(pl->buf, topic, tl);
+    memcpy(pl->buf + tl, data, dl);
+    return pl;
+}
+static mq_payload_t* payload_ref(mq_payload_t* pl) {
+    atomic_fetch_add_explicit(&pl->refs, 1, memory_order_relaxed);
+    return pl;
+}
+static void payload_unref(mq_payload_t* pl) {
+    if (atomic_fetch_sub_explicit(&pl->refs, 1, memory_order_acq_rel) == 1) free(pl);
+}
+
+// Mensaje saliente pendiente de ACK: cabecera propia + cuerpo compartido, listo para retransmitir.
+typedef struct mq_outmsg {
+    struct mq_outmsg* next;
+    struct mq_outmsg* prev;
+    struct mq_conn* sub;
+    mq_timer_t timer;   // vencimiento de retransmisión en la rueda
+    uint32_t seq;
+    uint64_t sent_us;   // instante del último envío (muestra de RTT)
+    int      tries;     // envíos realizados
+    uint64_t tx;        // orden del último envío (hace de "packet number" para pérdidas)
+    size_t   len;       // tamaño del datagrama (cabecera + cuerpo)
+    uint8_t  hdr[MQ_HDR_MAX];   // cabecera ya en orden de red (lo único propio del suscriptor)
+    uint8_t  hlen;
+    mq_payload_t* pl;   // cuerpo compartido
+} mq_outmsg_t;
+
+/* --- Ventana anti-duplicados por publisher ---
+   Si se pierde el ACK del broker, el publisher retransmite un DATA que ya se
+   repartió; sin memoria de lo recibido se volvía a encolar para todos los
+   suscriptores (amplificación del fan-out justo cuando hay pérdida). Cada
+   conexión recuerda los últimos MQ_DEDUP_WINDOW seq recibidos en un bitmap
+   circular (bit seq % ventana), como la ventana anti-replay de IPsec/QUIC:
+   - seq > hi: nuevo; se limpian los bits de los seq que quedan atrás y hi = seq;
+   - hi - ventana < seq <= hi: nuevo sólo si su bit está a 0;
+   - más viejo que la ventana: no se sabe si ya se repartió (dedup_stale).
+   El duplicado se vuelve a confirmar (el ACK era lo que faltaba) pero no se
+   reparte. Uno demasiado viejo ni se reparte ni se confirma, sólo se cuenta
+   (viejos_rx): confirmarlo diría al publisher que se entregó. La ventana cubre
+   los seq en vuelo del publisher (su -w está acotado a MQ_DEDUP_WINDOW), así
+   que sólo pasa con un DATA muy retrasado. Un HELLO sobre una conexión que ya
+   existe (publisher v1 que se reinicia en la misma dirección y puerto y vuelve
+   a empezar en seq 1) abre una sesión nueva y vacía la ventana. */
+#define MQ_DEDUP_WINDOW 1024    // seq recordados por conexión (múltiplo de 64)
+
+typedef struct {
+    uint32_t hi;                            // mayor seq recibido (0 = ninguno)
+    uint64_t bits[MQ_DEDUP_WINDOW / 64];
+} mq_dedup_t;
+
+static bool dedup_stale(const mq_dedup_t* d, uint32_t seq) {
+    return seq <= d->hi && d->hi - seq >= MQ_DEDUP_WINDOW;
+}
+
+static bool dedup_fresh(mq_dedup_t* d, uint32_t seq) {
+    if (seq > d->hi) {
+        if (seq - d->hi >= MQ_DEDUP_WINDOW) memset(d->bits, 0, sizeof(d->bits));
+        else for (uint32_t q = d->hi + 1; q != seq + 1; q++) d->bits[(q / 64) % (MQ_DEDUP_WINDOW / 64)] &= ~(1ull << (q % 64));
+        d->hi = seq;
+    } else if (dedup_stale(d, seq)) {
+        return false;
+    }
+    uint64_t* w = &d->bits[(seq / 64) % (MQ_DEDUP_WINDOW / 64)], m = 1ull << (seq % 64);
+    if (*w & m) return false;
+    *w |= m;
+    return true;
+}
+
+/* Conexión con un cliente (publisher o suscriptor), indexada por Connection ID.
+   Recepción: los seq que llegan de él, pendientes de un ACK agregado.
+   Envío (si está suscrito): cola por suscriptor; [head .. next_tx) son los
+   paquetes en vuelo (como mucho send_window), [next_tx .. tail] los que esperan
+   hueco en la ventana. */
+typedef struct mq_conn {
+    struct mq_conn* next;          // cadena del bucket de la tabla de conexiones
+    uint64_t key;                  // CID del cliente (o clave derivada de la dirección en v1)
+    bool     has_cid;              // el cliente habla la versión con CID: responder con él
+    struct sockaddr_in addr;       // última dirección vista (puede cambiar: migración)
+    mq_rangeset_t ack_rs;          // seq recibidos pendientes de confirmar
+    mq_dedup_t dedup;              // DATA ya repartidos (ver dedup_fresh)
+    uint64_t ack_largest_at_us;    // llegada del mayor seq (para ack_delay)
+    struct mq_conn* ack_next;      // lista de conexiones con ACK pendiente
+    bool     ack_pending;
+    struct mq_topic**  topics;     // suscripciones (tópicos internados, ver registro)
+    size_t   ntopics, tcap;
+    uint32_t next_seq;             // último seq asignado en el espacio de este suscriptor
+    uint64_t last_pub;             // último publish encolado (evita duplicar si casan varios filtros)
+    mq_outmsg_t* head;
+    mq_outmsg_t* tail;
+    mq_outmsg_t* next_tx;  // primer paquete aún no enviado
+    size_t   queued;
+    int      inflight;
+    uint64_t tx_count;          // envíos realizados a este suscriptor
+    uint64_t largest_acked_tx;  // mayor 'tx' confirmado
+    mq_rtt_t rtt;               // RTT/PTO de este camino
+    mq_cc_t  cc;                // ventana de congestión de este camino
+    bool     pacing;            // espaciar envíos según cwnd/srtt
+    uint64_t pace_next_us;      // instante a partir del cual sale el próximo paquete
+    mq_timer_t pace_timer;      // despierta la cola cuando el pacing la frenó
+    unsigned long qdrops;       // DATA descartados por cola llena (total)
+    unsigned long qdrops_logged;   // parte ya avisada en el log
+    uint64_t qdrop_log_ms;      // último aviso de cola llena (ver MQ_DROP_LOG_MS)
+    unsigned long qdrops_sent;  // total anunciado al suscriptor en el último MQ_FWD
+    uint64_t qdrop_fwd_ms;      // cuándo se envió ese MQ_FWD
+    uint64_t last_rx_ms;        // último paquete recibido de este cliente
+    int      fails;             // entregas abandonadas seguidas sin oír al cliente
+    mq_timer_t idle_timer;      // baja de la conexión inactiva (ver conn_on_idle)
+} mq_conn_t;
+
+static bool same_addr(const struct sockaddr_in* a, const struct sockaddr_in* b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/* --- Registro de tópicos ---
+   Antes find_subs() recorría las 128 entradas de subs[] con strcmp() en cada
+   DATA y devolvía como mucho 64. Ahora:
+   - Los tópicos se internan en una tabla hash encadenada (FNV-1a): cada nombre
+     existe una sola vez y cada mq_topic_t guarda su lista de suscriptores en un
+     array dinámico sin tope. Un publish cuesta O(1) + O(suscriptores del tópico).
+   - Las conexiones se reservan una a una (punteros estables para los timers y
+     las colas) y se indexan por Connection ID, para despachar cada paquete
+     entrante a su conexión en O(1).
+   Ambas tablas duplican sus buckets cuando la carga supera 1. */
+#define MQ_HASH_INITIAL 64
+
+typedef struct mq_topic {
+    struct mq_topic* next;     // cadena del bucket
+    uint32_t hash;
+    mq_conn_t** subs;          // suscriptores del tópico
+    size_t   nsubs, cap;
+    size_t   len;
+    bool     wildcard;         // filtro con '+'/'#': sólo se alcanza vía trie
+    uint64_t shards;           // -n/-f: shards o workers con suscriptores (bit i = hilo i)
+    char     name[];           // nombre internado
+} mq_topic_t;
+
+static MQ_SHARD_LOCAL mq_topic_t**   topic_tab;   // buckets de tópicos
+static MQ_SHARD_LOCAL size_t         topic_nb, topic_n;
+static MQ_SHARD_LOCAL mq_conn_t**    conn_tab;    // buckets de conexiones por CID
+static MQ_SHARD_LOCAL size_t         conn_nb, conn_n;
+
+static uint32_t fnv1a_step(uint32_t h, const void* p, size_t n) {
+    const uint8_t* b = p;
+    for (size_t i=0;i<n;i++) { h ^= b[i]; h *= 16777619u; }
+    return h;
+}
+static uint32_t fnv1a(const void* p, size_t n) { return fnv1a_step(2166136261u, p, n); }
+
+static uint32_t conn_hash(uint64_t key) { return fnv1a(&key, sizeof(key)); }
+
+static void topic_rehash(void) {
+    size_t nb = topic_nb ? topic_nb * 2 : MQ_HASH_INITIAL;
+    mq_topic_t** tab = calloc(nb, sizeof(*tab));
+    if (!tab) return;                       // sin memoria: seguir con cadenas más largas
+    for (size_t i=0;i<topic_nb;i++)
+        for (mq_topic_t* t = topic_tab[i], *nx; t; t = nx) {
+            nx = t->next;
+            t->next = tab[t->hash & (nb-1)];
+            tab[t->hash & (nb-1)] = t;
         }
-        tries++;
+    free(topic_tab);
+    topic_tab = tab; topic_nb = nb;
+}
+
+// Los nombres llegan como (puntero, longitud) dentro del datagrama, sin '\0'.
+static mq_topic_t* topic_find(const char* name, size_t len) {
+    if (!topic_nb) return NULL;
+    uint32_t h = fnv1a(name, len);
+    for (mq_topic_t* t = topic_tab[h & (topic_nb-1)]; t; t = t->next)
+        if (t->hash == h && t->len == len && memcmp(t->name, name, len) == 0) return t;
+    return NULL;
+}
+
+// Tópico exacto para un publish: los filtros con comodines no casan por nombre literal.
+static mq_topic_t* topic_lookup(const char* name, size_t len) {
+    mq_topic_t* t = topic_find(name, len);
+    return t && !t->wildcard ? t : NULL;
+}
+
+static mq_topic_t* topic_intern(const char* name, size_t len) {
+    mq_topic_t* t = topic_find(name, len);
+    if (t) return t;
+    if (topic_n >= topic_nb) topic_rehash();
+    if (!topic_nb) return NULL;
+    t = calloc(1, sizeof(*t) + len + 1);
+    if (!t) { perror("calloc"); return NULL; }
+    memcpy(t->name, name, len);
+    t->len = len;
+    t->hash = fnv1a(name, len);
+    t->next = topic_tab[t->hash & (topic_nb-1)];
+    topic_tab[t->hash & (topic_nb-1)] = t;
+    topic_n++;
+    return t;
+}
+
+static void topic_del_sub(mq_topic_t* t, const mq_conn_t* sub) {
+    for (size_t i=0;i<t->nsubs;i++)
+        if (t->subs[i] == sub) { t->subs[i] = t->subs[--t->nsubs]; return; }
+}
+
+static bool topic_add_sub(mq_topic_t* t, mq_conn_t* sub) {
+    if (t->nsubs == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4;
+        mq_conn_t** v = realloc(t->subs, cap * sizeof(*v));
+        if (!v) { perror("realloc"); return false; }
+        t->subs = v; t->cap = cap;
     }
-    fprintf(stderr, "[broker] timeout esperando ACK seq=%u\n", p->hdr.seq);
-    return -1;
+    t->subs[t->nsubs++] = sub;
+    return true;
+}
+
+static void conn_rehash(void) {
+    size_t nb = conn_nb ? conn_nb * 2 : MQ_HASH_INITIAL;
+    mq_conn_t** tab = calloc(nb, sizeof(*tab));
+    if (!tab) return;
+    for (size_t i=0;i<conn_nb;i++)
+        for (mq_conn_t* c = conn_tab[i], *nx; c; c = nx) {
+            nx = c->next;
+            uint32_t h = conn_hash(c->key) & (nb-1);
+            c->next = tab[h]; tab[h] = c;
+        }
+    free(conn_tab);
+    conn_tab = tab; conn_nb = nb;
 }
 
-/* --- Tabla de suscriptores por tópico ---
-   Este broker mantiene una tabla simple de (addr, topic). En QUIC cada cliente
-   podría corresponder a una "conexión" con Connection ID; aquí tratamos a cada
-   suscriptor por su dirección IP:port. */
-typedef struct { struct sockaddr_in addr; char topic[128]; bool active; } subscriber_t;
-#define MAX_SUBS 128
-static subscriber_t subs[MAX_SUBS];
-
-static void add_sub(const struct sockaddr_in* a, const char* topic) {
-    for (int i=0;i<MAX_SUBS;i++) if (!subs[i].active) {
-        subs[i].addr = *a;
-        strncpy(subs[i].topic, topic, sizeof(subs[i].topic)-1);
-        subs[i].active = true;
-        printf("[broker] SUB %s -> %s:%d\n", subs[i].topic, inet_ntoa(a->sin_addr), ntohs(a->sin_port));
+/* --- Trie de filtros con comodines ---
+   Tópicos jerárquicos "a/b/c" con comodines al estilo MQTT:
+   - '+' casa exactamente un nivel ("sensors/+/temp").
+   - '#' casa cero o más niveles y sólo puede ir al final ("sensors/#" recibe
+     "sensors", "sensors/x" y "sensors/x/y").
+   Los filtros sin comodines siguen en el registro hash (topic_lookup); sólo los
+   que llevan '+'/'#' se insertan en el trie. Cada nodo es un nivel; sus hijos
+   literales viven en una tabla hash global de aristas indexada por (padre,
+   segmento), el hijo '+' cuelga aparte del nodo y un filtro "x/#" se guarda en
+   el nodo de "x". Casar un publish recorre el trie nivel a nivel: cuesta
+   O(profundidad × ramas '+' vivas), independiente del número de suscripciones. */
+typedef struct mq_tnode {
+    struct mq_tnode* next;     // cadena del bucket de aristas
+    struct mq_tnode* parent;
+    uint32_t hash;             // hash(padre, segmento)
+    struct mq_tnode* plus;     // hijo '+'
+    mq_topic_t* filter;        // filtro que termina en este nodo
+    mq_topic_t* multi;         // filtro "<este nodo>/#"
+    uint16_t len;
+    char     seg[];
+} mq_tnode_t;
+
+static MQ_SHARD_LOCAL mq_tnode_t*  trie_root;
+static MQ_SHARD_LOCAL mq_tnode_t** edge_tab;      // buckets de aristas literales
+static MQ_SHARD_LOCAL size_t       edge_nb, edge_n;
+
+static uint32_t edge_hash(const mq_tnode_t* parent, const char* seg, size_t len) {
+    return fnv1a_step(fnv1a(&parent, sizeof(parent)), seg, len);
+}
+
+static mq_tnode_t* edge_find(const mq_tnode_t* parent, const char* seg, size_t len) {
+    if (!edge_nb) return NULL;
+    uint32_t h = edge_hash(parent, seg, len);
+    for (mq_tnode_t* n = edge_tab[h & (edge_nb-1)]; n; n = n->next)
+        if (n->hash == h && n->parent == parent && n->len == len && memcmp(n->seg, seg, len) == 0) return n;
+    return NULL;
+}
+
+static void edge_rehash(void) {
+    size_t nb = edge_nb ? edge_nb * 2 : MQ_HASH_INITIAL;
+    mq_tnode_t** tab = calloc(nb, sizeof(*tab));
+    if (!tab) return;
+    for (size_t i=0;i<edge_nb;i++)
+        for (mq_tnode_t* n = edge_tab[i], *nx; n; n = nx) {
+            nx = n->next;
+            n->next = tab[n->hash & (nb-1)];
+            tab[n->hash & (nb-1)] = n;
+        }
+    free(edge_tab);
+    edge_tab = tab; edge_nb = nb;
+}
+
+static mq_tnode_t* tnode_new(mq_tnode_t* parent, const char* seg, size_t len) {
+    mq_tnode_t* n = calloc(1, sizeof(*n) + len + 1);
+    if (!n) { perror("calloc"); return NULL; }
+    n->parent = parent;
+    n->len = (uint16_t)len;
+    memcpy(n->seg, seg, len);
+    return n;
+}
+
+static mq_tnode_t* edge_get(mq_tnode_t* parent, const char* seg, size_t len) {
+    mq_tnode_t* n = edge_find(parent, seg, len);
+    if (n) return n;
+    if (edge_n >= edge_nb) edge_rehash();
+    if (!edge_nb || !(n = tnode_new(parent, seg, len))) return NULL;
+    n->hash = edge_hash(parent, seg, len);
+    n->next = edge_tab[n->hash & (edge_nb-1)];
+    edge_tab[n->hash & (edge_nb-1)] = n;
+    edge_n++;
+    return n;
+}
+
+// Filtro válido: '+' y '#' ocupan un nivel entero y '#' sólo puede ser el último.
+static bool filter_valid(const char* f, size_t len, bool* wildcard) {
+    *wildcard = false;
+    for (size_t i=0;i<len;i++) {
+        if (f[i] != '+' && f[i] != '#') continue;
+        bool last = i + 1 == len;
+        if ((i && f[i-1] != '/') || (!last && f[i+1] != '/')) return false;
+        if (f[i] == '#' && !last) return false;
+        *wildcard = true;
+    }
+    return true;
+}
+
+// Inserta un filtro con comodines (ya validado e internado) en el trie.
+static bool trie_insert(mq_topic_t* t) {
+    if (!trie_root && !(trie_root = tnode_new(NULL, "", 0))) return false;
+    mq_tnode_t* n = trie_root;
+    for (const char* lvl = t->name;;) {
+        const char* e = strchr(lvl, '/');
+        size_t len = e ? (size_t)(e - lvl) : strlen(lvl);
+        if (len == 1 && *lvl == '#') { n->multi = t; return true; }
+        if (len == 1 && *lvl == '+') {
+            if (!n->plus && !(n->plus = tnode_new(n, "+", 1))) return false;
+            n = n->plus;
+        } else if (!(n = edge_get(n, lvl, len))) return false;
+        if (!e) break;
+        lvl = e + 1;
+    }
+    n->filter = t;
+    return true;
+}
+
+typedef void (*mq_match_fn)(mq_topic_t* t, void* arg);
+
+// [lvl, end): resto del tópico por casar; done: ya no quedan niveles.
+static void trie_walk(const mq_tnode_t* n, const char* lvl, const char* end, bool done, mq_match_fn fn, void* arg) {
+    if (n->multi) fn(n->multi, arg);
+    if (done) { if (n->filter) fn(n->filter, arg); return; }
+    const char* e = memchr(lvl, '/', (size_t)(end - lvl));
+    size_t len = (size_t)((e ? e : end) - lvl);
+    const mq_tnode_t* c = edge_find(n, lvl, len);
+    if (c) trie_walk(c, e ? e + 1 : end, end, !e, fn, arg);
+    if (n->plus) trie_walk(n->plus, e ? e + 1 : end, end, !e, fn, arg);
+}
+
+// Llama a fn() por cada filtro con comodines que casa con 'topic' (len bytes).
+static void trie_match(const char* topic, size_t len, mq_match_fn fn, void* arg) {
+    if (!trie_root) return;
+    const char* end = topic + len;
+    // Como en MQTT, los tópicos "$..." quedan fuera de los comodines del primer nivel.
+    if (len && topic[0] == '$') {
+        const char* e = memchr(topic, '/', len);
+        const mq_tnode_t* c = edge_find(trie_root, topic, (size_t)((e ? e : end) - topic));
+        if (c) trie_walk(c, e ? e + 1 : end, end, !e, fn, arg);
         return;
     }
-    fprintf(stderr, "[broker] tabla de suscriptores llena\n");
+    trie_walk(trie_root, topic, end, false, fn, arg);
 }
-static int find_subs(const char* topic, int* idxs, int cap){
-    int c=0; for(int i=0;i<MAX_SUBS && c<cap;i++)
-        if (subs[i].active && strcmp(subs[i].topic, topic)==0) idxs[c++]=i;
+
+/* --- Tabla de conexiones ---
+   Clave: el CID que elige el cliente (versión 2 del header). Los clientes sin
+   CID (versión 1) se identifican por dirección con una clave sintética que
+   lleva el bit alto a 1, rango que los clientes no usan para sus CID. */
+#define MQ_CID_LEGACY (1ull << 63)
+
+static uint64_t conn_key(const mq_view_t* v, const struct sockaddr_in* from) {
+    if (v->has_cid) return v->cid & ~MQ_CID_LEGACY;
+    return MQ_CID_LEGACY | (uint64_t)ntohl(from->sin_addr.s_addr) << 16 | ntohs(from->sin_port);
+}
+
+static mq_conn_t* conn_find(uint64_t key) {
+    if (!conn_nb) return NULL;
+    for (mq_conn_t* c = conn_tab[conn_hash(key) & (conn_nb-1)]; c; c = c->next)
+        if (c->key == key) return c;
+    return NULL;
+}
+
+static void sub_on_pace(int sock, mq_timer_t* t, uint64_t now);
+static void conn_on_idle(int sock, mq_timer_t* t, uint64_t now);
+
+static mq_conn_t* conn_new(uint64_t key, bool has_cid, const struct sockaddr_in* a) {
+    if (conn_n >= conn_nb) conn_rehash();
+    if (!conn_nb) return NULL;
+    mq_conn_t* c = calloc(1, sizeof(*c));
+    if (!c) { perror("calloc"); return NULL; }
+    c->key = key;
+    c->has_cid = has_cid;
+    c->addr = *a;
+    rtt_init(&c->rtt);
+    cc_init(&c->cc, cc_algo);
+    c->pacing = pacing_default;
+    c->pace_timer.fn = sub_on_pace;
+    c->idle_timer.fn = conn_on_idle;
+    c->last_rx_ms = now_ms();
+    tw_schedule(&c->idle_timer, c->last_rx_ms + MQ_IDLE_TIMEOUT_MS);
+    uint32_t h = conn_hash(key) & (conn_nb-1);
+    c->next = conn_tab[h]; conn_tab[h] = c;
+    conn_n++;
     return c;
 }
 
-/* main:
-   - Crea socket UDP y espera datagramas.
-   - Procesa tipos: HELLO/HELLO_OK (simple handshake), SUB (registro),
-     PUB (publicación), DATA (mensaje a reenviar).
-   - En el caso de DATA reenvía de forma fiable a cada suscriptor usando
-     mq_send_reliable (ACK + retransmisión). */
-int main(int argc, char** argv) {
-    if (argc < 2){ fprintf(stderr,"Uso: %s <port>\n", argv[0]); return 1; }
-    int port = atoi(argv[1]);
+// Tópico o filtro ya validado; los filtros con comodines se cuelgan además del trie.
+static mq_topic_t* filter_intern(const char* f, size_t len, bool wildcard) {
+    mq_topic_t* t = topic_intern(f, len);
+    if (!t) return NULL;
+    if (wildcard && !t->wildcard) {
+        if (!trie_insert(t)) return NULL;
+        t->wildcard = true;
+    }
+    return t;
+}
+
+static void shard_announce(mq_topic_t* t);
+
+static void add_sub(mq_conn_t* sub, const char* topic, size_t tl, bool pacing) {
+    bool wildcard;
+    if (!filter_valid(topic, tl, &wildcard)) {
+        printf("[broker] SUB con filtro inválido '%.*s' de %s:%d (ignorado)\n", (int)tl, topic,
+               inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port));
+        return;
+    }
+    mq_topic_t* t = filter_intern(topic, tl, wildcard);
+    if (!t) return;
+    // Un SUB retransmitido (se perdió nuestro ACK) no debe duplicar la suscripción.
+    for (size_t i=0;i<sub->ntopics;i++) if (sub->topics[i] == t) return;
+    if (sub->ntopics == sub->tcap) {
+        size_t cap = sub->tcap ? sub->tcap * 2 : 2;
+        mq_topic_t** v = realloc(sub->topics, cap * sizeof(*v));
+        if (!v) { perror("realloc"); return; }
+        sub->topics = v; sub->tcap = cap;
+    }
+    if (!topic_add_sub(t, sub)) return;
+    sub->topics[sub->ntopics++] = t;
+    if (t->nsubs == 1) shard_announce(t);   // primer suscriptor local: avisar al dueño
+    sub->pacing |= pacing;
+    printf("[broker] SUB %s -> %s:%d%s\n", t->name, inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port),
+           sub->pacing ? " (pacing)" : "");
+}
+
+/* --- Motor de fan-out no bloqueante ---
+   Reemplaza al antiguo mq_send_reliable() (stop-and-wait bloqueante por suscriptor)
+   por una ventana deslizante con repetición selectiva por suscriptor:
+   - fanout_enqueue: serializa el DATA y lo encola en el suscriptor; si hay hueco
+     en la ventana se envía en el acto.
+   - fanout_on_ack: el bucle principal entrega cada MQ_ACK recibido; se liberan los
+     paquetes cubiertos por sus rangos (estén donde estén en la ventana) y se
+     rellenan los huecos. Un paquete no confirmado enviado MQ_PKT_THRESHOLD envíos
+     antes que el mayor confirmado se da por perdido y se retransmite ya, sin
+     esperar al timeout (umbral de paquetes de QUIC, RFC 9002).
+   - fanout_on_retx: callback de la rueda de timers; cada paquete tiene su propio
+     timer, así que sólo se retransmite el que se perdió (o se descarta si agotó
+     MQ_MAX_RETX).
+   Es la misma idea que un stack QUIC: un único loop de eventos y estado de
+   retransmisión por conexión, en vez de un bloqueo por paquete.
+
+   Pacing: con el pacing activo (-p en el broker o flag MQ_SUBF_PACING en el SUB)
+   los paquetes nuevos de un suscriptor salen espaciados a MQ_PACING_GAIN *
+   cwnd / srtt en vez de a ráfagas de sendto() seguidos, que desbordan el buffer
+   de recepción del suscriptor. Se usa la misma rueda de timers: como su tick es
+   de 1 ms, cada vencimiento deja salir lo que corresponde a 1 ms de ritmo (una
+   mini-ráfaga acotada), en lugar de un timerfd/SO_TXTIME por paquete. Hasta
+   tener muestra de RTT no se espacia (la ventana inicial ya acota la ráfaga). */
+static void fanout_on_retx(int sock, mq_timer_t* t, uint64_t now);
+
+// Intervalo entre paquetes de 'len' bytes al ritmo actual (0 = sin pacing).
+static uint64_t pace_interval_us(const mq_conn_t* sub, size_t len) {
+    if (!sub->pacing || !sub->rtt.has_sample) return 0;
+    return (uint64_t)((double)len * (double)sub->rtt.srtt_us / (MQ_PACING_GAIN * (double)sub->cc.cwnd));
+}
+
+/* --- Envío por lotes ---
+   Los DATA del fan-out (nuevos y retransmisiones) no salen con un sendto() cada
+   uno: se apuntan en un vector de datagramas salientes y tx_flush() los emite
+   con sendmmsg(). Cada datagrama son dos iovec, la cabecera del suscriptor
+   (copiada a la entrada, 13 bytes o 21 con CID) y el cuerpo compartido, del que la entrada
+   guarda una referencia: así un ACK procesado en el mismo lote puede liberar el
+   mq_outmsg_t sin invalidar el envío pendiente. El vector se vacía cuando se
+   llena (-B N datagramas), cuando el más antiguo lleva más de -F µs esperando
+   y, siempre, al final de cada vuelta del bucle de eventos, antes de volver a
+   dormir en epoll_wait(). Con -B 1 cada DATA es una syscall, como antes.
+
+   GSO (-g): los DATA consecutivos de un mismo suscriptor con el mismo tamaño se
+   concatenan (más iovec) en una sola entrada del vector y salen como un
+   súper-buffer con UDP_SEGMENT; el kernel (o la NIC) lo corta en datagramas de
+   'seg' bytes. Sólo el último segmento puede ser más corto, así que un DATA
+   menor cierra la entrada y uno mayor abre otra. */
+#define MQ_TX_BATCH_MAX     64
+#define MQ_TX_DEADLINE_US  200
+#define MQ_DGRAM_MAX       (MQ_MAX_PAYLOAD + 256)
+#define MQ_GSO_SEGS_MAX     16
 
-    int s = socket(AF_INET, SOCK_DGRAM, 0);
-    if (s<0){ perror("socket"); return 1; }
+static int      tx_batch = 32;
+static uint64_t tx_deadline_us = MQ_TX_DEADLINE_US;
+static bool     gso_enabled;
+static MQ_SHARD_LOCAL struct sockaddr_in tx_addr[MQ_TX_BATCH_MAX];
+static MQ_SHARD_LOCAL struct iovec       tx_iov[MQ_TX_BATCH_MAX][2 * MQ_GSO_SEGS_MAX];
+static MQ_SHARD_LOCAL uint8_t            tx_hdr[MQ_TX_BATCH_MAX][MQ_GSO_SEGS_MAX][MQ_HDR_MAX];
+static MQ_SHARD_LOCAL mq_payload_t*      tx_pl[MQ_TX_BATCH_MAX][MQ_GSO_SEGS_MAX];
+static MQ_SHARD_LOCAL struct mmsghdr     tx_msgs[MQ_TX_BATCH_MAX];
+static MQ_SHARD_LOCAL union { char buf[CMSG_SPACE(sizeof(uint16_t))]; struct cmsghdr align; } tx_ctl[MQ_TX_BATCH_MAX];
+static MQ_SHARD_LOCAL struct {
+    uint16_t seg;       // tamaño de segmento (= primer DATA de la entrada)
+    uint16_t nseg;      // datagramas concatenados
+    bool     closed;    // el último segmento fue más corto: no admite más
+} tx_gso[MQ_TX_BATCH_MAX];
+static MQ_SHARD_LOCAL int      tx_n;
+static MQ_SHARD_LOCAL uint64_t tx_first_us;   // encolado del datagrama más antiguo pendiente
+
+static void tx_flush(int sock) {
+    for (int i=0;i<tx_n;i++) {
+        struct msghdr* h = &tx_msgs[i].msg_hdr;
+        h->msg_iovlen = 2u * tx_gso[i].nseg;
+        if (tx_gso[i].nseg < 2) { h->msg_control = NULL; h->msg_controllen = 0; continue; }
+        h->msg_control = tx_ctl[i].buf;
+        h->msg_controllen = sizeof(tx_ctl[i].buf);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(h);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type  = UDP_SEGMENT;
+        cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cm), &tx_gso[i].seg, sizeof(uint16_t));
+    }
+    int off = 0;
+    while (off < tx_n) {
+        int r = sendmmsg(sock, tx_msgs + off, (unsigned)(tx_n - off), 0);
+        stats.tx_calls++;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");   // lo que no salió lo recupera el PTO
+            break;
+        }
+        for (int i=off;i<off+r;i++) stats.tx_dgrams += tx_gso[i].nseg;
+        off += r;
+    }
+    for (int i=0;i<tx_n;i++)
+        for (int k=0;k<tx_gso[i].nseg;k++) payload_unref(tx_pl[i][k]);
+    tx_n = 0;
+}
+
+// Con GSO: última entrada pendiente hacia 'a' si todavía admite un segmento de 'len' bytes.
+static int tx_gso_entry(const struct sockaddr_in* a, size_t len) {
+    for (int i=tx_n-1;i>=0;i--) {
+        if (!same_addr(&tx_addr[i], a)) continue;
+        if (tx_gso[i].closed || len > tx_gso[i].seg || tx_gso[i].nseg >= MQ_GSO_SEGS_MAX) return -1;
+        return i;
+    }
+    return -1;
+}
+
+static void tx_push(int sock, const struct sockaddr_in* a, const uint8_t* hdr, size_t hlen, mq_payload_t* pl,
+                    uint64_t t_us) {
+    size_t len = hlen + pl->len;
+    if (len > MQ_DGRAM_MAX) return;
+    int i = gso_enabled ? tx_gso_entry(a, len) : -1;
+    if (i < 0) {
+        i = tx_n++;
+        tx_addr[i] = *a;
+        tx_msgs[i].msg_hdr = (struct msghdr){ .msg_name = &tx_addr[i], .msg_namelen = sizeof(tx_addr[i]),
+                                              .msg_iov = tx_iov[i] };
+        tx_gso[i].seg = (uint16_t)len; tx_gso[i].nseg = 0; tx_gso[i].closed = false;
+        if (i == 0) tx_first_us = t_us;
+    } else {
+        tx_gso[i].closed = len < tx_gso[i].seg;
+    }
+    int k = tx_gso[i].nseg++;
+    memcpy(tx_hdr[i][k], hdr, hlen);
+    tx_pl[i][k]  = payload_ref(pl);
+    tx_iov[i][2*k]   = (struct iovec){ tx_hdr[i][k], hlen };
+    tx_iov[i][2*k+1] = (struct iovec){ pl->buf, pl->len };
+    if (tx_n >= tx_batch || t_us - tx_first_us >= tx_deadline_us) tx_flush(sock);
+}
+
+/* Seq de avance ("forward seq"): todo seq por debajo está confirmado o se
+   abandonó tras MQ_MAX_RETX, así que el suscriptor no debe esperarlo más. Va en
+   hdr.ack de cada DATA (el suscriptor no lo usaba) y en un MQ_FWD suelto cuando
+   se abandona un paquete, parecido a lo que hace el frame RESET_STREAM de QUIC. */
+static uint32_t sub_fwd(const mq_conn_t* sub) {
+    return sub->head ? sub->head->seq : sub->next_seq + 1;
+}
+
+static void sub_send_fwd(int sock, mq_conn_t* sub) {
+    mq_packet_t p = {0};
+    p.hdr.type = MQ_FWD;
+    if (sub->has_cid) { p.hdr.type |= MQ_HDR_CID; p.cid = sub->key; }
+    p.hdr.ack = sub_fwd(sub);
+    p.hdr.seq = (uint32_t)sub->qdrops;
+    uint8_t b[MQ_HDR_MAX];
+    size_t n = mq_pack(b, sizeof(b), &p);
+    sendto(sock, b, n, 0, (const struct sockaddr*)&sub->addr, sizeof(sub->addr));
+    sub->qdrops_sent = sub->qdrops;
+    sub->qdrop_fwd_ms = now_ms();
+}
+
+static void sub_transmit(int sock, mq_conn_t* sub, mq_outmsg_t* m, uint64_t now) {
+    put_u32(m->hdr + offsetof(mq_hdr_t, ack), sub_fwd(sub));
+    tx_push(sock, &sub->addr, m->hdr, m->hlen, m->pl, now_us());
+    m->sent_us = now_us();
+    if (m->tries++) stats.retx++; else stats.data_tx++;
+    m->tx = ++sub->tx_count;
+    tw_schedule(&m->timer, now + rtt_pto_ms(&sub->rtt));
+}
+
+// Envía paquetes nuevos mientras quede hueco en la ventana y en cwnd (y el pacing lo permita).
+static void sub_fill_window(int sock, mq_conn_t* sub, uint64_t now) {
+    while (sub->next_tx && sub->inflight < send_window && cc_can_send(&sub->cc, sub->next_tx->len)) {
+        mq_outmsg_t* m = sub->next_tx;
+        uint64_t gap = pace_interval_us(sub, m->len);
+        if (gap) {
+            uint64_t t = now_us();
+            if (sub->pace_next_us > t + MQ_GRANULARITY_US) {   // adelantado más de un tick: esperar
+                stats.paced++;
+                tw_schedule(&sub->pace_timer, (sub->pace_next_us + 999) / 1000);
+                break;
+            }
+            sub->pace_next_us = (sub->pace_next_us > t ? sub->pace_next_us : t) + gap;
+        }
+        sub->next_tx = m->next;
+        sub->inflight++;
+        sub->cc.bytes_in_flight += m->len;
+        sub_transmit(sock, sub, m, now);
+    }
+}
+
+// Quita un paquete en vuelo de la cola (ACK recibido o entrega fallida).
+static void sub_remove(mq_conn_t* sub, mq_outmsg_t* m) {
+    tw_cancel(&m->timer);
+    if (m->prev) m->prev->next = m->next; else sub->head = m->next;
+    if (m->next) m->next->prev = m->prev; else sub->tail = m->prev;
+    sub->queued--;
+    sub->inflight--;
+    sub->cc.bytes_in_flight -= m->len;
+    payload_unref(m->pl);
+    free(m);
+}
+
+/* Encola un DATA: 'hdr' es la plantilla común (orden de host), de la que sólo
+   cambian por suscriptor el seq (siguiente de su espacio) y el CID; se codifica
+   en los 13-21 bytes propios del mq_outmsg_t. 'pl' es el cuerpo compartido (se
+   toma una referencia). El seq se asigna tras comprobar la cola, así un descarte
+   por cola llena no abre un hueco que nunca se llenaría. Los descartes se
+   cuentan y se avisan como mucho una vez por segundo y suscriptor. */
+static void fanout_enqueue(int sock, mq_conn_t* sub, const mq_hdr_t* hdr, mq_payload_t* pl) {
+    if (sub->queued >= MQ_SUB_QUEUE_MAX) {
+        stats.dropped++; stats.qdrop++;
+        sub->qdrops++;
+        uint64_t now = now_ms();
+        if (now - sub->qdrop_log_ms >= MQ_DROP_LOG_MS) {
+            fprintf(stderr, "[broker] cola llena para %s:%d: %lu DATA descartados (total %lu)\n",
+                    inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port),
+                    sub->qdrops - sub->qdrops_logged, sub->qdrops);
+            sub->qdrops_logged = sub->qdrops;
+            sub->qdrop_log_ms = now;
+        }
+        return;
+    }
+    mq_outmsg_t* m = malloc(sizeof(*m));
+    if (!m) { perror("malloc"); return; }
+    m->next = NULL; m->prev = sub->tail; m->sub = sub;
+    m->seq = ++sub->next_seq; m->sent_us = 0; m->tries = 0;
+    mq_hdr_t h = *hdr;
+    h.seq = m->seq;
+    if (sub->has_cid) h.type |= MQ_HDR_CID;
+    m->hlen = (uint8_t)mq_hdr_encode(m->hdr, &h, sub->key);
+    m->pl = payload_ref(pl); m->len = m->hlen + pl->len;
+    m->timer.next = m->timer.prev = NULL; m->timer.fn = fanout_on_retx;
+    if (sub->tail) sub->tail->next = m; else sub->head = m;
+    sub->tail = m;
+    if (!sub->next_tx) sub->next_tx = m;
+    sub->queued++;
+    sub_fill_window(sock, sub, now_ms());
+}
+
+static void fanout_on_ack(int sock, mq_conn_t* sub, const mq_ackframe_t* f) {
+    uint64_t now = now_ms();
+    if (!sub->inflight) return;
+    // Repetición selectiva: liberar cada paquete en vuelo cubierto por los rangos.
+    // El más reciente de los confirmados (mayor tx) da la muestra de RTT.
+    bool acked = false;
+    uint64_t best_tx = 0, sample_us = 0;
+    for (mq_outmsg_t* m = sub->head, *nx; m && m != sub->next_tx; m = nx) {
+        nx = m->next;
+        if (!rs_contains(&f->rs, m->seq)) continue;
+        if (verbose)
+            printf("[broker] entregado a %s:%d (seq=%u)\n",
+                   inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port), m->seq);
+        if (m->tx > best_tx) { best_tx = m->tx; sample_us = m->tries == 1 ? now_us() - m->sent_us : 0; }
+        if (m->tx > sub->largest_acked_tx) sub->largest_acked_tx = m->tx;
+        cc_on_acked(&sub->cc, m->len, m->tx, now_us(), &sub->rtt);
+        sub_remove(sub, m);
+        acked = true;
+    }
+    if (!acked) return;
+    if (sample_us) rtt_on_sample(&sub->rtt, sample_us, f->ack_delay_us);
+    sub->rtt.pto_count = 0;
+    // Los huecos por debajo del mayor confirmado delatan pérdidas.
+    for (mq_outmsg_t* m = sub->head; m && m != sub->next_tx; m = m->next)
+        if (m->tx + MQ_PKT_THRESHOLD <= sub->largest_acked_tx && m->tries < MQ_MAX_RETX) {
+            cc_on_lost(&sub->cc, m->tx, sub->tx_count);
+            stats.fast_retx++;
+            sub_transmit(sock, sub, m, now);
+        }
+    sub_fill_window(sock, sub, now);
+    // Descartes por cola llena aún no anunciados: el suscriptor no los ve como hueco.
+    if (sub->qdrops != sub->qdrops_sent && (!sub->head || now - sub->qdrop_fwd_ms >= MQ_DROP_LOG_MS))
+        sub_send_fwd(sock, sub);
+}
+
+/* --- ACKs agregados hacia los clientes ---
+   Los seq recibidos de cada peer (publishers, SUB/PUB) no se confirman uno a uno:
+   se acumulan en un mq_rangeset_t mientras se vacía el socket y al final del
+   vaciado ack_flush() envía un único MQ_ACK con rangos por peer. El estado vive
+   en la propia conexión; las que tienen algo pendiente se enlazan en ack_list. */
+#define MQ_RX_BURST  64   // datagramas procesados por vuelta del bucle de eventos
+
+static MQ_SHARD_LOCAL mq_conn_t* ack_list;
+
+static void ack_send_one(int sock, mq_conn_t* c, uint64_t now_us_) {
+    mq_ackframe_t f = { .ack_delay_us = (uint32_t)(now_us_ - c->ack_largest_at_us), .rs = c->ack_rs };
+    mq_send_ack(sock, &c->addr, sizeof(c->addr), c->has_cid ? &c->key : NULL, &f);
+    c->ack_rs.n = 0;
+}
+
+static void ack_flush(int sock) {
+    uint64_t t = now_us();
+    for (mq_conn_t* c = ack_list; c; c = c->ack_next) {
+        if (c->ack_rs.n) ack_send_one(sock, c, t);
+        c->ack_pending = false;
+    }
+    ack_list = NULL;
+}
+
+static void ack_note(int sock, mq_conn_t* c, uint32_t seq) {
+    if (!c->ack_pending) {
+        c->ack_pending = true;
+        c->ack_rs.n = 0;
+        c->ack_next = ack_list; ack_list = c;
+    }
+    // Sin sitio para otro rango: mandar lo acumulado antes de que se pierda.
+    if (c->ack_rs.n == MQ_ACK_MAX_RANGES && !rs_contains(&c->ack_rs, seq)) ack_send_one(sock, c, now_us());
+    rs_add(&c->ack_rs, seq);
+    if (seq == c->ack_rs.r[0].hi) c->ack_largest_at_us = now_us();
+}
+
+static void sub_on_pace(int sock, mq_timer_t* t, uint64_t now) {
+    sub_fill_window(sock, container_of(t, mq_conn_t, pace_timer), now);
+}
+
+/* --- Vida de las conexiones ---
+   No hay cierre explícito (en QUIC: CONNECTION_CLOSE o idle timeout), así que
+   una conexión se da de baja cuando:
+     - no tiene suscripciones (publisher, o cliente que sólo saludó) y lleva
+       MQ_IDLE_TIMEOUT_MS sin mandar nada;
+     - es un suscriptor y se abandonan MQ_CONN_MAX_FAILS entregas seguidas
+       (cada una tras MQ_MAX_RETX) sin recibir nada de él entretanto.
+   Un suscriptor sin tráfico no manda nada (no hay keepalive), así que su
+   inactividad sola no basta para darlo por muerto. La baja lo quita de sus
+   tópicos y libera su cola, sus timers y su estado. Como puede que sólo
+   estuviera parado (SIGSTOP, portátil suspendido), al suscriptor se le manda un
+   MQ_RESET, y otro por cada ACK que llegue después de una conexión que ya no
+   existe (el primero se puede perder), como el stateless reset de QUIC: el
+   suscriptor abre una conexión nueva y repite el SUB. Con -n/-f el aviso de interés a otros hilos no se retira: a
+   lo sumo llegan publish que ya no casan con nadie. */
+static void conn_send_reset(int sock, uint64_t key, bool has_cid, const struct sockaddr_in* a) {
+    mq_packet_t p = {0};
+    p.hdr.type = MQ_RESET;
+    if (has_cid) { p.hdr.type |= MQ_HDR_CID; p.cid = key; }
+    uint8_t b[MQ_HDR_MAX];
+    size_t n = mq_pack(b, sizeof(b), &p);
+    sendto(sock, b, n, 0, (const struct sockaddr*)a, sizeof(*a));
+}
+
+static void conn_close(mq_conn_t* c, const char* why) {
+    printf("[broker] conexión %016llx (%s:%d) cerrada: %s\n", (unsigned long long)c->key,
+           inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), why);
+    stats.closed++;
+    stats.dropped += c->queued;   // lo que quedaba en su cola ya no se entregará
+    for (size_t i=0;i<c->ntopics;i++) topic_del_sub(c->topics[i], c);
+    for (mq_outmsg_t* m = c->head, *nx; m; m = nx) {
+        nx = m->next;
+        tw_cancel(&m->timer);
+        payload_unref(m->pl);
+        free(m);
+    }
+    tw_cancel(&c->pace_timer);
+    tw_cancel(&c->idle_timer);
+    if (c->ack_pending)
+        for (mq_conn_t** pp = &ack_list; *pp; pp = &(*pp)->ack_next)
+            if (*pp == c) { *pp = c->ack_next; break; }
+    for (mq_conn_t** pp = &conn_tab[conn_hash(c->key) & (conn_nb-1)]; *pp; pp = &(*pp)->next)
+        if (*pp == c) { *pp = c->next; break; }
+    conn_n--;
+    free(c->topics);
+    free(c);
+}
+
+static void conn_on_idle(int sock, mq_timer_t* t, uint64_t now) {
+    (void)sock;
+    mq_conn_t* c = container_of(t, mq_conn_t, idle_timer);
+    if (c->ntopics) return;   // suscriptor: lo juzgan sus entregas (fanout_on_retx)
+    if (now - c->last_rx_ms < MQ_IDLE_TIMEOUT_MS) { tw_schedule(t, c->last_rx_ms + MQ_IDLE_TIMEOUT_MS); return; }
+    conn_close(c, "inactiva");
+}
+
+static void fanout_on_retx(int sock, mq_timer_t* t, uint64_t now) {
+    mq_outmsg_t* m = container_of(t, mq_outmsg_t, timer);
+    mq_conn_t* sub = m->sub;
+    stats.pto++;
+    // Backoff exponencial hasta el próximo ACK: un paso por episodio (lo marca el
+    // paquete más antiguo en vuelo), no uno por cada timer de la ventana.
+    if (m == sub->head) {
+        sub->rtt.pto_count++;
+        cc_on_lost(&sub->cc, m->tx, sub->tx_count);
+        if (sub->rtt.pto_count >= MQ_CC_PERSISTENT) cc_on_persistent_congestion(&sub->cc);
+    }
+    if (m->tries < MQ_MAX_RETX) { sub_transmit(sock, sub, m, now); return; }
+    bool was_head = m == sub->head;
+    stats.dropped++;
+    fprintf(stderr, "[broker] timeout esperando ACK seq=%u\n", m->seq);
+    fprintf(stderr, "[broker] fallo entrega a %s:%d\n",
+            inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port));
+    sub_remove(sub, m);
+    if (++sub->fails >= MQ_CONN_MAX_FAILS) {
+        conn_send_reset(sock, sub->key, sub->has_cid, &sub->addr);
+        conn_close(sub, "no responde");
+        return;
+    }
+    if (was_head) sub_send_fwd(sock, sub);   // el forward seq avanzó: avisar aunque no haya más DATA
+    sub_fill_window(sock, sub, now);
+}
+
+// Encola 'out' en todos los suscriptores de un tópico o filtro (callback de trie_match).
+// Un suscriptor al que casan varios filtros recibe el publish una sola vez (last_pub).
+typedef struct { int sock; const mq_hdr_t* hdr; mq_payload_t* pl; uint64_t pub; } fanout_ctx_t;
+static void fanout_topic(mq_topic_t* t, void* arg) {
+    const fanout_ctx_t* ctx = arg;
+    for (size_t i=0;i<t->nsubs;i++) {
+        mq_conn_t* sub = t->subs[i];
+        if (sub->last_pub == ctx->pub) continue;
+        sub->last_pub = ctx->pub;
+        fanout_enqueue(ctx->sock, sub, ctx->hdr, ctx->pl);
+    }
+}
+static MQ_SHARD_LOCAL uint64_t publish_count;
+
+// Fan-out en este shard de un cuerpo ya serializado (topic + data en pl->buf).
+static void fanout_local(int sock, mq_payload_t* pl, uint16_t tl, uint16_t dl) {
+    // localizar suscriptores: exactos por el índice hash y con comodines por
+    // el trie; encolar (envío inmediato si hay ventana)
+    mq_hdr_t h = { .type = MQ_DATA, .topic_len = tl, .data_len = dl };
+    const char* topic = (const char*)pl->buf;
+    fanout_ctx_t ctx = { sock, &h, pl, ++publish_count };
+    mq_topic_t* t = topic_lookup(topic, tl);
+    if (t) fanout_topic(t, &ctx);
+    trie_match(topic, tl, fanout_topic, &ctx);
+}
+
+/* --- Shards (opción -n N) ---
+   Con N > 1 el broker arranca N hilos, cada uno fijado a un núcleo con su
+   socket UDP en el mismo puerto (SO_REUSEPORT), su epoll y todo su estado
+   (MQ_SHARD_LOCAL: conexiones, tópicos, trie, rueda de timers, lotes de E/S).
+   El kernel reparte los datagramas por hash de la 4-tupla, así que cada
+   cliente cae siempre en el mismo shard, que es dueño de su conexión (ACKs,
+   ventanas, colas, retransmisiones) y le envía desde su propio socket.
+   Los tópicos se reparten por hash: el dueño de T es fnv1a(T) % N y anota en
+   mq_topic_t.shards qué shards tienen suscriptores de T. Los filtros con
+   comodines se anuncian a todos, porque casan tópicos de cualquier dueño.
+   - SUB en el shard X: suscripción local y, si es la primera a ese tópico o
+     filtro en X, aviso (MQ_X_INTEREST) al dueño o a todos si es un filtro.
+   - DATA en el shard A: A confirma y deduplica; si no es el dueño del tópico
+     pasa el cuerpo al dueño (MQ_X_DATA). El dueño calcula la máscara de shards
+     interesados (tópico exacto + filtros que casan) y entrega a cada uno una
+     referencia al cuerpo (MQ_X_ROUTED), que hace su fan-out local.
+   Los shards sólo se hablan por colas MPSC sin cerrojos (una por shard: todos
+   producen, sólo el dueño consume) más un eventfd para despertarlo. Cada
+   vuelta consume como mucho MQ_XQ_BURST mensajes para que los ACK de los
+   suscriptores no esperen tras un publisher rápido, y una cola con MQ_XQ_MAX
+   publish pendientes descarta los nuevos (como la cola llena de un suscriptor). El orden
+   por publisher y tópico se conserva: el camino A -> dueño -> X es único y FIFO.
+   Limitaciones: el aviso de interés es asíncrono (los publish que el dueño
+   rutea antes de recibirlo no llegan a ese shard) y una conexión que migra de
+   dirección puede caer en otro shard, que no la conoce.
+
+   --- Pipeline ingesta / fan-out (opción -f W) ---
+   Con un tópico de miles de suscriptores el fan-out acapara el bucle y los
+   ACK a los publishers esperan detrás. Con -f hay un solo socket: el hilo
+   principal (shards[0]) lee, parsea, confirma y deduplica los DATA de los
+   publishers y nada más; los suscriptores los atienden W workers
+   (shards[1..W]), cada uno con su cola, su rueda de timers y sus conexiones,
+   que envían por el mismo socket. Cada conexión de suscriptor pertenece al
+   worker 1 + hash(CID) % W: la ingesta le reenvía sus SUB y ACK como
+   datagramas (MQ_X_PACKET) y anota en su propia tabla de tópicos qué workers
+   tienen suscriptores, así que cada publish sólo cuesta en la ingesta una
+   referencia por worker interesado (MQ_X_ROUTED). SUB y DATA de un worker
+   viajan por la misma cola FIFO, por lo que un publish posterior a un SUB
+   siempre lo encuentra registrado. -f no se combina con -n. */
+#define MQ_SHARDS_MAX 64       // la máscara de interés es un uint64_t
+#define MQ_XQ_MAX     65536    // publish pendientes por cola; más allá se descartan
+#define MQ_XQ_BURST   256      // mensajes consumidos por vuelta del bucle
+
+typedef struct mq_xnode { _Atomic(struct mq_xnode*) next; } mq_xnode_t;
+
+enum { MQ_X_DATA, MQ_X_ROUTED, MQ_X_INTEREST, MQ_X_PACKET };
+typedef struct {
+    mq_xnode_t    node;
+    int           kind;
+    int           from;        // MQ_X_INTEREST: shard con suscriptores
+    mq_payload_t* pl;          // MQ_X_DATA / MQ_X_ROUTED: una referencia propia
+    uint16_t      tl, dl;
+    struct sockaddr_in addr;   // MQ_X_PACKET: remitente del datagrama
+    char          name[];      // MQ_X_INTEREST: tópico o filtro; MQ_X_PACKET: datagrama (tl bytes)
+} mq_xmsg_t;
+
+/* Cola MPSC intrusiva (Vyukov): push es un atomic_exchange sobre head más el
+   enlace del nodo anterior; pop lo hace sólo el shard dueño desde tail. El
+   nodo 'stub' evita que la cola quede vacía del todo. Si un productor está
+   entre el exchange y el enlace, pop devuelve NULL y deja el resto para
+   después: ese productor aún no ha mirado 'signaled' y avisará por eventfd. */
+typedef struct {
+    _Atomic(mq_xnode_t*) head;
+    mq_xnode_t*  tail;
+    mq_xnode_t   stub;
+    atomic_int   signaled;     // hay un aviso pendiente en efd
+    atomic_int   depth;        // publish encolados y aún no consumidos
+    int          efd;
+} mq_xq_t;
+
+typedef struct {
+    int         id, sock, ep;
+    pthread_t   th;
+    mq_xq_t     q;
+    mq_stats_t  stats;         // contadores del hilo, copiados al terminar
+} mq_shard_t;
+
+static int nshards = 1;
+static int nworkers;           // -f: workers de fan-out (0 = sin pipeline)
+static mq_shard_t* shards;
+static MQ_SHARD_LOCAL mq_shard_t* shard_self;
+
+static void xq_init(mq_xq_t* q, int efd) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+    atomic_init(&q->signaled, 0);
+    atomic_init(&q->depth, 0);
+    q->efd = efd;
+}
+
+static void xq_link(mq_xq_t* q, mq_xnode_t* n) {
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    mq_xnode_t* prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+static void xq_push(mq_xq_t* q, mq_xmsg_t* m) {
+    xq_link(q, &m->node);
+    if (!atomic_exchange(&q->signaled, 1)) {   // sólo el primero desde el último drenado despierta
+        uint64_t one = 1;
+        if (write(q->efd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    }
+}
+
+static mq_xmsg_t* xq_pop(mq_xq_t* q) {
+    mq_xnode_t* tail = q->tail;
+    mq_xnode_t* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (!next) {
+        if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) return NULL;   // push a medias
+        xq_link(q, &q->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (!next) return NULL;
+    }
+    q->tail = next;
+    return container_of(tail, mq_xmsg_t, node);
+}
+
+static int topic_owner(const char* name, size_t len) { return (int)(fnv1a(name, len) % (uint32_t)nshards); }
+
+// Reserva sitio en la cola del hilo 'to' para un mensaje con 'extra' bytes; NULL si está llena.
+static mq_xmsg_t* xmsg_new(int to, size_t extra) {
+    mq_xq_t* q = &shards[to].q;
+    if (atomic_fetch_add_explicit(&q->depth, 1, memory_order_relaxed) >= MQ_XQ_MAX) {
+        atomic_fetch_sub_explicit(&q->depth, 1, memory_order_relaxed);
+        stats.xdrop++;
+        return NULL;
+    }
+    mq_xmsg_t* m = malloc(sizeof(*m) + extra);
+    if (!m) { perror("malloc"); atomic_fetch_sub_explicit(&q->depth, 1, memory_order_relaxed); return NULL; }
+    return m;
+}
+
+// Pasa al shard 'to' una referencia al cuerpo de un publish.
+static void shard_send(int to, int kind, mq_payload_t* pl, uint16_t tl, uint16_t dl) {
+    mq_xmsg_t* m = xmsg_new(to, 0);
+    if (!m) return;
+    m->kind = kind; m->pl = payload_ref(pl); m->tl = tl; m->dl = dl;
+    xq_push(&shards[to].q, m);
+    stats.xfwd++;
+}
+
+static void route_mask(mq_topic_t* t, void* arg) { *(uint64_t*)arg |= t->shards; }
+
+// En el dueño del tópico: entregar el publish a cada shard con suscriptores que casen.
+static void shard_route(int sock, mq_payload_t* pl, uint16_t tl, uint16_t dl) {
+    const char* topic = (const char*)pl->buf;
+    uint64_t mask = 0;
+    mq_topic_t* t = topic_lookup(topic, tl);
+    if (t) mask |= t->shards;
+    trie_match(topic, tl, route_mask, &mask);
+    for (int i=0; mask; i++, mask >>= 1) {
+        if (!(mask & 1)) continue;
+        if (i == shard_self->id) fanout_local(sock, pl, tl, dl);
+        else shard_send(i, MQ_X_ROUTED, pl, tl, dl);
+    }
+}
+
+// Publish recibido en este shard (ya confirmado y deduplicado).
+static void publish(int sock, mq_payload_t* pl, uint16_t tl, uint16_t dl) {
+    if (nworkers) { shard_route(sock, pl, tl, dl); return; }   // pipeline: sólo repartir a los workers
+    if (nshards == 1) { fanout_local(sock, pl, tl, dl); return; }
+    int owner = topic_owner((const char*)pl->buf, tl);
+    if (owner == shard_self->id) shard_route(sock, pl, tl, dl);
+    else shard_send(owner, MQ_X_DATA, pl, tl, dl);
+}
+
+// Primer suscriptor local de t: anotarlo y avisar al dueño del tópico (a todos si es un filtro).
+static void shard_announce(mq_topic_t* t) {
+    if (nshards == 1) return;
+    int self = shard_self->id, owner = topic_owner(t->name, t->len);
+    t->shards |= 1ull << self;
+    for (int i=0;i<nshards;i++) {
+        if (i == self || (!t->wildcard && i != owner)) continue;
+        mq_xmsg_t* m = malloc(sizeof(*m) + t->len);
+        if (!m) { perror("malloc"); continue; }
+        m->kind = MQ_X_INTEREST; m->from = self; m->pl = NULL;
+        m->tl = (uint16_t)t->len; m->dl = 0;
+        memcpy(m->name, t->name, t->len);
+        xq_push(&shards[i].q, m);
+    }
+}
+
+// Anota que el hilo 'who' tiene suscriptores de 'name' (tópico exacto o filtro).
+static void interest_add(const char* name, size_t len, int who) {
+    bool wildcard;
+    if (!filter_valid(name, len, &wildcard)) return;
+    mq_topic_t* t = filter_intern(name, len, wildcard);
+    if (t) t->shards |= 1ull << who;
+}
+
+// Pipeline (-f): un SUB o ACK de suscriptor va al worker dueño de su conexión.
+static void pipe_forward(uint64_t key, const mq_view_t* p, const uint8_t* buf, size_t n,
+                         const struct sockaddr_in* from) {
+    int w = 1 + (int)(conn_hash(key) % (uint32_t)nworkers);
+    if (p->hdr.type == MQ_SUB) interest_add(p->topic, p->hdr.topic_len, w);
+    mq_xmsg_t* m = xmsg_new(w, n);
+    if (!m) return;
+    m->kind = MQ_X_PACKET; m->pl = NULL; m->tl = (uint16_t)n; m->dl = 0;
+    m->addr = *from;
+    memcpy(m->name, buf, n);
+    xq_push(&shards[w].q, m);
+    stats.xfwd++;
+}
+
+static void handle_packet(int s, const uint8_t* buf, size_t n, const struct sockaddr_in* from, socklen_t fl);
+
+// Consume la cola del shard; se llama cuando su eventfd está listo.
+static void shard_drain(int sock) {
+    mq_xq_t* q = &shard_self->q;
+    uint64_t v;
+    if (read(q->efd, &v, sizeof(v)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+    atomic_store(&q->signaled, 0);   // antes de drenar: un push posterior vuelve a avisar
+    atomic_thread_fence(memory_order_seq_cst);
+    int k = 0;
+    for (mq_xmsg_t* m; k < MQ_XQ_BURST && (m = xq_pop(q)); free(m), k++) {
+        if (m->kind != MQ_X_INTEREST) atomic_fetch_sub_explicit(&q->depth, 1, memory_order_relaxed);
+        switch (m->kind) {
+            case MQ_X_INTEREST: interest_add(m->name, m->tl, m->from); break;
+            case MQ_X_PACKET:   handle_packet(sock, (const uint8_t*)m->name, m->tl, &m->addr, sizeof(m->addr)); break;
+            case MQ_X_DATA:   shard_route(sock, m->pl, m->tl, m->dl); payload_unref(m->pl); break;
+            case MQ_X_ROUTED: fanout_local(sock, m->pl, m->tl, m->dl); payload_unref(m->pl); break;
+        }
+    }
+    if (k == MQ_XQ_BURST) {   // quedan mensajes: volver a despertarnos tras atender el socket
+        uint64_t one = 1;
+        if (write(q->efd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    }
+}
+
+/* --- Ingesta por lotes ---
+   En vez de un recvfrom() por datagrama, recvmmsg() trae hasta rx_batch
+   datagramas por syscall a un array de buffers preasignado; después se
+   despachan en bloque con handle_packet(). Con -b 1 se degrada a una lectura
+   por datagrama (útil para comparar en bench/ingest_batch.sh).
+   Con GRO (-g) el kernel puede entregar varios datagramas del mismo emisor
+   pegados en un buffer; el cmsg UDP_GRO indica el tamaño de segmento y
+   rx_segment() los vuelve a separar. */
+#define MQ_RX_BATCH_MAX 64
+#define MQ_RX_BUFSZ     2048
+#define MQ_GRO_BUFSZ    65536
+
+static int rx_batch = MQ_RX_BATCH_MAX;
+static MQ_SHARD_LOCAL uint8_t*           rx_buf[MQ_RX_BATCH_MAX];
+static MQ_SHARD_LOCAL struct sockaddr_in rx_addr[MQ_RX_BATCH_MAX];
+static MQ_SHARD_LOCAL struct iovec       rx_iov[MQ_RX_BATCH_MAX];
+static MQ_SHARD_LOCAL struct mmsghdr     rx_msgs[MQ_RX_BATCH_MAX];
+static MQ_SHARD_LOCAL union { char buf[CMSG_SPACE(sizeof(int))]; struct cmsghdr align; } rx_ctl[MQ_RX_BATCH_MAX];
+
+static bool rx_init(bool gro) {
+    size_t sz = gro ? MQ_GRO_BUFSZ : MQ_RX_BUFSZ;
+    for (int i=0;i<MQ_RX_BATCH_MAX;i++) {
+        if (!(rx_buf[i] = malloc(sz))) { perror("malloc"); return false; }
+        rx_iov[i].iov_base = rx_buf[i];
+        rx_iov[i].iov_len  = sz;
+        rx_msgs[i].msg_hdr.msg_iov    = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rx_msgs[i].msg_hdr.msg_name   = &rx_addr[i];
+    }
+    return true;
+}
+
+// Tamaño de segmento GRO del datagrama i (su longitud si no vino agregado).
+static size_t rx_segment(int i) {
+    struct msghdr* h = &rx_msgs[i].msg_hdr;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(h); cm; cm = CMSG_NXTHDR(h, cm))
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg; memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+            if (seg > 0) return (size_t)seg;
+        }
+    return rx_msgs[i].msg_len;
+}
+
+// Lee hasta 'max' datagramas; devuelve cuántos hay en rx_msgs[] (0 si el socket está vacío).
+static int rx_read(int s, int max) {
+    if (max > rx_batch) max = rx_batch;
+    for (int i=0;i<max;i++) {
+        rx_msgs[i].msg_hdr.msg_namelen = sizeof(rx_addr[i]);
+        rx_msgs[i].msg_hdr.msg_flags = 0;
+        rx_msgs[i].msg_hdr.msg_control = rx_ctl[i].buf;
+        rx_msgs[i].msg_hdr.msg_controllen = sizeof(rx_ctl[i].buf);
+    }
+    int n = recvmmsg(s, rx_msgs, (unsigned)max, 0, NULL);
+    stats.rx_calls++;
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recvmmsg");
+        return 0;
+    }
+    stats.rx_dgrams += (unsigned long)n;
+    return n;
+}
+
+/* handle_packet: procesa un datagrama recibido según su tipo.
+   Primero lo demultiplexa a su conexión en O(1) por Connection ID (o por
+   dirección si el cliente no manda CID); si el CID llega desde otra dirección
+   se actualiza la de la conexión (migración, p. ej. NAT rebinding).
+   HELLO/HELLO_OK (simple handshake, sin estado), SUB (registro), PUB (publicación),
+   DATA (mensaje a reenviar) y ACK (de suscriptores, avanza el fan-out). */
+static void handle_packet(int s, const uint8_t* buf, size_t n, const struct sockaddr_in* from, socklen_t fl) {
+    mq_view_t pk; if (!mq_parse(buf, n, &pk)) return;
+    const mq_view_t* p = &pk;
+
+    uint64_t key = conn_key(p, from);
+    if (p->hdr.type == MQ_HELLO) {
+        // HANDSHAKE SENCILLO: HELLO -> HELLO_OK (con el CID del cliente, si lo trae)
+        // En QUIC el handshake sería TLS/CRYPTO y derivación de claves. No crea
+        // estado: la conexión nace con su primer SUB/PUB/DATA en el hilo que la
+        // atiende (con -f, un suscriptor en su worker y no en el de ingesta).
+        mq_packet_t r = {0}; r.hdr.type = MQ_HELLO_OK;
+        if (p->has_cid) { r.hdr.type |= MQ_HDR_CID; r.cid = key; }
+        uint8_t b[64]; size_t bn = mq_pack(b, sizeof(b), &r);
+        sendto(s, b, bn, 0, (const struct sockaddr*)from, fl);
+        printf("[broker] HELLO_OK -> %s:%d\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+        mq_conn_t* c = conn_find(key);
+        if (c) memset(&c->dedup, 0, sizeof(c->dedup));   // cliente reiniciado: sus seq vuelven a empezar
+        return;
+    }
+    if (nworkers && shard_self->id == 0 && (p->hdr.type == MQ_SUB || p->hdr.type == MQ_ACK)) {
+        pipe_forward(key, p, buf, n, from);   // -f: los suscriptores los atiende su worker
+        return;
+    }
+    mq_conn_t* c = conn_find(key);
+    if (!c) {
+        if (p->hdr.type == MQ_ACK) {   // ACK de una conexión desconocida (p. ej. cerrada): que se vuelva a suscribir
+            conn_send_reset(s, key, p->has_cid, from);
+            return;
+        }
+        if (!(c = conn_new(key, p->has_cid, from))) return;
+    } else if (!same_addr(&c->addr, from)) {
+        printf("[broker] conexión %016llx migra %s:%d -> ", (unsigned long long)key,
+               inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port));
+        printf("%s:%d\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+        c->addr = *from;
+    }
+    c->last_rx_ms = now_ms();
+    c->fails = 0;
+
+    switch (p->hdr.type) {
+        case MQ_SUB: {
+            // Registro de suscriptor por tópico y ACK de su SUB
+            bool pacing = pacing_default || (p->hdr.data_len && (p->data[0] & MQ_SUBF_PACING));
+            add_sub(c, p->topic, p->hdr.topic_len, pacing);
+            ack_note(s, c, p->hdr.seq);
+        } break;
+        case MQ_PUB: {
+            // El publisher anuncia una publicación (podría usarse para metadata)
+            printf("[broker] PUB topic='%.*s' de %s:%d\n", (int)p->hdr.topic_len, p->topic, inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+            ack_note(s, c, p->hdr.seq);
+        } break;
+        case MQ_DATA: {
+            // Recibimos datos de publisher -> confirmamos al publisher (ACK agregado)
+            // Luego encolamos DATA en el motor de fan-out de cada suscriptor del topic.
+            if (dedup_stale(&c->dedup, p->hdr.seq)) { stats.old_rx++; break; }   // fuera de la ventana: sin ACK
+            ack_note(s, c, p->hdr.seq); // confirmar al publisher
+            if (!dedup_fresh(&c->dedup, p->hdr.seq)) { stats.dup_rx++; break; }   // retransmisión: sólo re-ACK
+            stats.data_rx++;
+
+            // Serializar una sola vez el cuerpo, compartido por todas las colas; el
+            // coste por suscriptor es un mq_outmsg_t con su cabecera (seq y CID propios).
+            // Con -n el fan-out puede hacerlo otro shard (ver publish()).
+            mq_payload_t* pl = payload_new(p->topic, p->hdr.topic_len, p->data, p->hdr.data_len);
+            if (!pl) break;
+            publish(s, pl, p->hdr.topic_len, p->hdr.data_len);
+            payload_unref(pl);
+        } break;
+        case MQ_ACK: {
+            // ACK (con rangos) de un suscriptor: avanza su cola de fan-out
+            mq_ackframe_t f;
+            if (mq_ack_parse(p, &f)) fanout_on_ack(s, c, &f);
+        } break;
+        default: break;
+    }
+}
+
+static atomic_int stop;   // lock-free: se puede escribir desde el manejador de señales
+static void on_signal(int sig) { (void)sig; stop = 1; }
+
+static void stats_add(mq_stats_t* a, const mq_stats_t* b) {
+    a->data_rx += b->data_rx; a->data_tx += b->data_tx; a->retx += b->retx;
+    a->fast_retx += b->fast_retx; a->pto += b->pto; a->dropped += b->dropped; a->paced += b->paced;
+    a->qdrop += b->qdrop;
+    a->dup_rx += b->dup_rx; a->old_rx += b->old_rx; a->rx_dgrams += b->rx_dgrams; a->rx_calls += b->rx_calls;
+    a->tx_dgrams += b->tx_dgrams; a->tx_calls += b->tx_calls;
+    a->xfwd += b->xfwd; a->xdrop += b->xdrop;
+    a->closed += b->closed;
+}
+
+static void print_stats(void) {
+    printf("[broker] stats: data_rx=%lu dup_rx=%lu viejos_rx=%lu data_tx=%lu retx=%lu (fast=%lu, pto=%lu) descartados=%lu (cola_llena=%lu) "
+           "pacing_esperas=%lu perdida_est=%.2f%% rx_syscalls/msg=%.3f tx_syscalls/msg=%.3f conexiones_cerradas=%lu\n",
+           stats.data_rx, stats.dup_rx, stats.old_rx, stats.data_tx, stats.retx, stats.fast_retx, stats.pto, stats.dropped, stats.qdrop,
+           stats.paced,
+           stats.data_tx + stats.retx ? 100.0 * (double)stats.retx / (double)(stats.data_tx + stats.retx) : 0.0,
+           stats.rx_dgrams ? (double)stats.rx_calls / (double)stats.rx_dgrams : 0.0,
+           stats.tx_dgrams ? (double)stats.tx_calls / (double)stats.tx_dgrams : 0.0, stats.closed);
+    if (nshards > 1 || nworkers) {
+        printf("[broker] %s=%d entre_hilos=%lu desborde_hilos=%lu", nworkers ? "workers" : "shards",
+               nworkers ? nworkers : nshards, stats.xfwd, stats.xdrop);
+        for (int i=0;i<nshards+nworkers;i++) printf(" [%d: rx=%lu tx=%lu fwd=%lu]", i, shards[i].stats.data_rx, shards[i].stats.data_tx, shards[i].stats.xfwd);
+        printf("\n");
+    }
+}
+
+/* Bucle de eventos de un shard: epoll sobre su socket (no bloqueante), su
+   eventfd (mensajes de otros shards, con -n) y la rueda de timers, con
+   timeout de epoll_wait() = próximo tick con retransmisiones pendientes. */
+static int shard_loop(mq_shard_t* sh) {
+    int s = sh->sock;
+    while (!stop) {
+        struct epoll_event evs[8];
+        int r = epoll_wait(sh->ep, evs, 8, tw_next_timeout(now_ms()));
+        if (r < 0 && errno != EINTR) { perror("epoll_wait"); return -1; }
+        tw_advance(s, now_ms());
+        bool readable = false;
+        for (int i=0;i<r;i++) {
+            if (evs[i].data.fd == s) readable = true;
+            else shard_drain(s);
+        }
+        if (!readable) {   // retransmisiones / pacing / otros shards (o, en un worker, la ingesta)
+            ack_flush(s);
+            tx_flush(s);
+            continue;
+        }
+
+        // Socket no bloqueante: vaciar los datagramas listos por lotes de recvmmsg(),
+        // como mucho MQ_RX_BURST por vuelta para que los ACK agregados y los timers
+        // no esperen de más. Un lote incompleto indica que el socket quedó vacío.
+        for (int k=0; k<MQ_RX_BURST; ) {
+            int want = MQ_RX_BURST - k < rx_batch ? MQ_RX_BURST - k : rx_batch;
+            int n = rx_read(s, want);
+            for (int i=0;i<n;i++) {
+                const struct msghdr* h = &rx_msgs[i].msg_hdr;
+                if (!rx_msgs[i].msg_len || (h->msg_flags & MSG_TRUNC)) continue;
+                size_t seg = rx_segment(i);
+                for (size_t off = 0; off < rx_msgs[i].msg_len; off += seg) {
+                    size_t len = rx_msgs[i].msg_len - off < seg ? rx_msgs[i].msg_len - off : seg;
+                    handle_packet(s, rx_buf[i] + off, len, &rx_addr[i], h->msg_namelen);
+                }
+            }
+            k += n;
+            if (n < want) break;
+        }
+        ack_flush(s);  // un MQ_ACK con rangos por peer para todo lo recibido
+        tx_flush(s);   // fan-out del lote, antes de volver a dormir
+    }
+    return 0;
+}
+
+// Cola entre hilos y su eventfd, vigilado por el epoll del hilo.
+static int shard_queue_open(mq_shard_t* sh) {
+    int efd = eventfd(0, EFD_NONBLOCK);
+    if (efd<0){ perror("eventfd"); return -1; }
+    xq_init(&sh->q, efd);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = efd };
+    if (epoll_ctl(sh->ep, EPOLL_CTL_ADD, efd, &ev)<0){ perror("epoll_ctl"); return -1; }
+    return 0;
+}
+
+/* Socket UDP del shard (con SO_REUSEPORT si hay varios), su epoll y, con -n,
+   el eventfd de su cola. 'gro' indica si el kernel aceptó UDP_GRO. */
+static int shard_open(mq_shard_t* sh, int id, int port, bool* gro) {
+    sh->id = id;
+    int s = sh->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s<0){ perror("socket"); return -1; }
+    int one = 1, zero = 0;
+    if (nshards > 1 && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)"); return -1;
+    }
     struct sockaddr_in addr = {0};
     addr.sin_family = AF_INET; addr.sin_addr.s_addr = htonl(INADDR_ANY); addr.sin_port = htons(port);
-    if (bind(s,(struct sockaddr*)&addr,sizeof(addr))<0){ perror("bind"); return 1; }
-
-    printf("[broker] escuchando UDP %d\n", port);
-
-    for (;;) {
-        uint8_t buf[2000]; struct sockaddr_in from; socklen_t fl = sizeof(from);
-        ssize_t n = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fl);
-        if (n <= 0) continue;
-        mq_packet_t p; if (!mq_unpack(buf, n, &p)) continue;
-
-        switch (p.hdr.type) {
-            case MQ_HELLO: {
-                // HANDSHAKE SENCILLO: HELLO -> HELLO_OK
-                // En QUIC el handshake sería TLS/CRYPTO y derivación de claves.
-                mq_packet_t r = {0}; r.hdr.type = MQ_HELLO_OK;
-                uint8_t b[64]; size_t bn = mq_pack(b, sizeof(b), &r);
-                sendto(s, b, bn, 0, (struct sockaddr*)&from, fl);
-                printf("[broker] HELLO_OK -> %s:%d\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
-            } break;
-            case MQ_SUB: {
-                // Registro de suscriptor por tópico y ACK de su SUB
-                add_sub(&from, p.topic);
-                mq_send_ack(s, &from, fl, p.hdr.seq);
-            } break;
-            case MQ_PUB: {
-                // El publisher anuncia una publicación (podría usarse para metadata)
-                printf("[broker] PUB topic='%s' de %s:%d\n", p.topic, inet_ntoa(from.sin_addr), ntohs(from.sin_port));
-                mq_send_ack(s, &from, fl, p.hdr.seq);
-            } break;
-            case MQ_DATA: {
-                // Recibimos datos de publisher -> confirmamos al publisher
-                // Luego reenviamos DATA de forma fiable a cada suscriptor del topic.
-                mq_send_ack(s, &from, fl, p.hdr.seq); // confirmar al publisher
-
-                // localizar suscriptores y reenviar
-                int idxs[64], cnt = find_subs(p.topic, idxs, 64);
-                for (int i=0;i<cnt;i++) {
-                    subscriber_t* sub = &subs[idxs[i]];
-                    mq_packet_t out = {0};
-                    out.hdr.type = MQ_DATA;
-                    out.hdr.seq  = p.hdr.seq; // REUTILIZA seq simple: en un diseño real habría space de packet numbers
-                    out.hdr.topic_len = (uint16_t)strlen(p.topic);
-                    out.hdr.data_len  = p.hdr.data_len;
-                    strncpy(out.topic, p.topic, sizeof(out.topic)-1);
-                    memcpy(out.data, p.data, p.hdr.data_len);
-
-                    // Envío fiable (espera ACK del suscriptor)
-                    if (mq_send_reliable(s, &sub->addr, sizeof(sub->addr), &out)==0)
-                        printf("[broker] entregado a %s:%d (seq=%u)\n",
-                               inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port), out.hdr.seq);
-                    else
-                        fprintf(stderr,"[broker] fallo entrega a %s:%d\n",
-                                inet_ntoa(sub->addr.sin_addr), ntohs(sub->addr.sin_port));
-                }
-            } break;
-            default: break;
+    if (bind(s,(struct sockaddr*)&addr,sizeof(addr))<0){ perror("bind"); return -1; }
+
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    sh->ep = epoll_create1(0);
+    if (sh->ep<0){ perror("epoll_create1"); return -1; }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = s };
+    if (epoll_ctl(sh->ep, EPOLL_CTL_ADD, s, &ev)<0){ perror("epoll_ctl"); return -1; }
+    if (nshards > 1 && shard_queue_open(sh) < 0) return -1;
+    *gro = false;
+    if (gso_enabled) {
+        // -g: GSO en el fan-out y GRO en la recepción. Se prueban ambos; sin soporte seguimos sin ellos.
+        if (setsockopt(s, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0) perror("setsockopt(UDP_GRO)");
+        else *gro = true;
+        if (setsockopt(s, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) < 0) {
+            perror("setsockopt(UDP_SEGMENT)"); gso_enabled = false;
+        }
+    }
+    return 0;
+}
+
+// Worker de fan-out (-f): sin socket propio; envía por el de la ingesta y sólo vigila su cola.
+static int worker_open(mq_shard_t* sh, int id, int sock) {
+    sh->id = id;
+    sh->sock = sock;
+    sh->ep = epoll_create1(0);
+    if (sh->ep<0){ perror("epoll_create1"); return -1; }
+    return shard_queue_open(sh);
+}
+
+static bool rx_gro;   // el kernel aceptó UDP_GRO (buffers de recepción grandes)
+
+static void* shard_main(void* arg) {
+    mq_shard_t* sh = arg;
+    shard_self = sh;
+    tw_init(now_ms());
+    if (nworkers || rx_init(rx_gro)) shard_loop(sh);   // los workers no leen del socket
+    else stop = 1;
+    sh->stats = stats;
+    return NULL;
+}
+
+// Arranca los hilos shards[first..last), cada uno fijado a un núcleo.
+static int threads_start(int first, int last) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    for (int i=first;i<last;i++) {
+        if ((errno = pthread_create(&shards[i].th, NULL, shard_main, &shards[i]))) { perror("pthread_create"); return -1; }
+        cpu_set_t cs; CPU_ZERO(&cs); CPU_SET(i % ncpu, &cs);
+        if ((errno = pthread_setaffinity_np(shards[i].th, sizeof(cs), &cs))) perror("pthread_setaffinity_np");
+    }
+    return 0;
+}
+
+// Con 'stop' ya puesto: despierta a cada hilo, lo espera y suma sus contadores.
+static void threads_join(int first, int last) {
+    for (int i=first;i<last;i++) {
+        uint64_t one = 1;
+        if (write(shards[i].q.efd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    }
+    for (int i=first;i<last;i++) {
+        pthread_join(shards[i].th, NULL);
+        stats_add(&stats, &shards[i].stats);
+    }
+}
+
+/* main:
+   - Crea socket UDP y espera datagramas; con SIGINT/SIGTERM imprime los contadores.
+   - Cada datagrama se procesa en handle_packet().
+   - En el caso de DATA lo encola en el motor de fan-out de cada suscriptor;
+     ACKs y retransmisiones se atienden desde el mismo bucle de eventos
+     (shard_loop()).
+   - Con -n N arranca N shards (ver "Shards") y el hilo principal sólo espera
+     la señal, los para y suma sus contadores.
+   - Con -f W el hilo principal hace la ingesta y W workers el fan-out (ver
+     "Pipeline"). */
+int main(int argc, char** argv) {
+    int opt; bool bad = false;
+    while ((opt = getopt(argc, argv, "w:c:pb:B:F:gn:f:v")) != -1) {
+        switch (opt) {
+            case 'w': send_window = atoi(optarg); break;
+            case 'b': rx_batch = atoi(optarg); break;
+            case 'B': tx_batch = atoi(optarg); break;
+            case 'F': tx_deadline_us = strtoull(optarg, NULL, 10); break;
+            case 'g': gso_enabled = true; break;
+            case 'p': pacing_default = true; break;
+            case 'v': verbose = true; break;
+            case 'n': nshards = atoi(optarg); break;
+            case 'f': nworkers = atoi(optarg); break;
+            case 'c':
+                if (!strcmp(optarg, "cubic")) cc_algo = &mq_cc_cubic;
+                else if (!strcmp(optarg, "newreno") || !strcmp(optarg, "reno")) cc_algo = &mq_cc_newreno;
+                else bad = true;
+                break;
+            default: bad = true; break;
         }
     }
+    if (bad || optind >= argc || send_window < 1 || rx_batch < 1 || rx_batch > MQ_RX_BATCH_MAX ||
+        tx_batch < 1 || tx_batch > MQ_TX_BATCH_MAX || nshards < 1 || nshards > MQ_SHARDS_MAX ||
+        nworkers < 0 || nworkers >= MQ_SHARDS_MAX || (nworkers && nshards > 1)) {
+        fprintf(stderr,"Uso: %s <port> [-w ventana] [-c cubic|newreno] [-p] [-b lote_rx (1..%d)]"
+                " [-B lote_tx (1..%d)] [-F plazo_tx_us] [-g] [-n shards (1..%d) | -f workers (1..%d)] [-v]\n",
+                argv[0], MQ_RX_BATCH_MAX, MQ_TX_BATCH_MAX, MQ_SHARDS_MAX, MQ_SHARDS_MAX - 1);
+        return 1;
+    }
+    int port = atoi(argv[optind]);
+
+    shards = calloc((size_t)(nshards + nworkers), sizeof(*shards));
+    if (!shards) { perror("calloc"); return 1; }
+    for (int i=0;i<nshards;i++) {
+        bool gro;
+        if (shard_open(&shards[i], i, port, &gro) < 0) return 1;
+        if (i == 0) rx_gro = gro;
+    }
+    for (int i=1;i<=nworkers;i++)
+        if (worker_open(&shards[i], i, shards[0].sock) < 0) return 1;
+
+    printf("[broker] escuchando UDP %d (ventana=%d, cc=%s, lote_rx=%d, lote_tx=%d/%lluus%s", port, send_window,
+           cc_algo->name, rx_batch, tx_batch, (unsigned long long)tx_deadline_us,
+           gso_enabled ? (rx_gro ? ", gso+gro" : ", gso") : (rx_gro ? ", gro" : ""));
+    if (nshards > 1) printf(", shards=%d", nshards);
+    if (nworkers) printf(", workers=%d", nworkers);
+    printf(")\n");
+
+    // Los hilos heredan la máscara: sólo el principal recibe SIGINT/SIGTERM.
+    sigset_t sigs; sigemptyset(&sigs); sigaddset(&sigs, SIGINT); sigaddset(&sigs, SIGTERM);
+    if (nshards == 1) {
+        shard_self = &shards[0];
+        tw_init(now_ms());
+        if (!rx_init(rx_gro)) return 1;
+        if (nworkers) {
+            pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+            if (threads_start(1, 1 + nworkers) < 0) return 1;
+            pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+        }
+        struct sigaction sa = {0}; sa.sa_handler = on_signal;   // sin SA_RESTART: epoll_wait() vuelve con EINTR
+        sigaction(SIGINT, &sa, NULL); sigaction(SIGTERM, &sa, NULL);
+        if (shard_loop(&shards[0]) < 0) return 1;
+        stop = 1;
+        shards[0].stats = stats;
+        threads_join(1, 1 + nworkers);
+        print_stats();
+        return 0;
+    }
+
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    if (threads_start(0, nshards) < 0) return 1;
+    int sig; sigwait(&sigs, &sig);
+    stop = 1;
+    threads_join(0, nshards);
+    print_stats();
     return 0;
 }
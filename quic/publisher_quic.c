@@ -16,8 +16,12 @@
 //    saludo de aplicación, no CRYPTO/TLS. QUIC integra TLS 1.3 dentro del
 //    propio protocolo y deriva claves para proteger paquetes.
 //  - No hay multiplexación por streams: cada DATA es un mensaje independiente.
-//  - No hay control de congestión ni flow control (no CUBIC/BBR ni ventanas).
-//  - No hay Connection IDs ni migración de path. Numeración de paquetes es simple.
+//  - Ventana deslizante fija de DATA en vuelo (-w) y pacing opcional (-p), pero sin
+//    control de congestión propio (sin cwnd NewReno/CUBIC/BBR) ni flow control
+//    negociado; el control de congestión lo hace el broker hacia los suscriptores.
+//  - Connection ID aleatorio de 64 bits por conexión (header v2, bit 0x80): sólo se
+//    aceptan paquetes del broker con ese CID. No hay validación de path ni rotación
+//    de CIDs. Numeración de paquetes es simple.
 //
 // Diferencia respecto a "Lab 3":
 //  - Si Lab 3 usaba TCP: allí la fiabilidad y CC vienen del kernel; aquí se
@@ -26,6 +30,7 @@
 //    básica (ACK + retries) parecida conceptualmente a lo que QUIC hace, pero
 //    simplificada.
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,132 +41,490 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/random.h>
+#include <poll.h>
+#include <pthread.h>
 
 #define MQ_MAX_PAYLOAD 1200   // límite práctico cercano a MTU, para que quepa en UDP
-#define MQ_TIMEOUT_MS  500    // timeout para esperar ACK (simula PTO simplificado)
+#define MQ_TIMEOUT_MS  500    // PTO inicial, mientras no hay muestras de RTT
 #define MQ_MAX_RETX    10     // número máximo de reintentos antes de fallar
 
-typedef enum { MQ_HELLO=1, MQ_HELLO_OK, MQ_SUB, MQ_PUB, MQ_DATA, MQ_ACK } mq_type_t;
+typedef enum { MQ_HELLO=1, MQ_HELLO_OK, MQ_SUB, MQ_PUB, MQ_DATA, MQ_ACK, MQ_FWD } mq_type_t;
 
 #pragma pack(push,1)
 // Header simple: tipo + seq (packet number) + ack + tamaños de campos variables.
 // En QUIC los headers son más complejos (long/short, connection_id, etc.).
 typedef struct { uint8_t type; uint32_t seq, ack; uint16_t topic_len, data_len; } mq_hdr_t;
 #pragma pack(pop)
+// Versión 2 del header: con el bit MQ_HDR_CID en type, tras los campos fijos va un
+// Connection ID de 64 bits (orden de red). Lo elige el cliente al arrancar y el
+// broker lo usa para encontrar la conexión aunque cambie nuestra dirección.
+#define MQ_HDR_CID   0x80
+#define MQ_TYPE_MASK 0x7f
 
-typedef struct { mq_hdr_t hdr; char topic[128]; uint8_t data[MQ_MAX_PAYLOAD]; } mq_packet_t;
+// cid: CID de la conexión que envía el paquete (aleatorio, bit alto a 0).
+typedef struct { mq_hdr_t hdr; uint64_t cid; char topic[128]; uint8_t data[MQ_MAX_PAYLOAD]; } mq_packet_t;
 
 /* now_ms:
    - Utilidad para medir tiempos en ms.
-   - En QUIC real hay timers más finos (PTO, handshake, retransmit), pero aquí
-     usamos un único timeout simple para ACKs. */
-static uint64_t now_ms(void){ struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts);
+   - Como en QUIC, el timeout de retransmisión es un PTO que sale del RTT
+     medido (mq_rtt_t); aquí no hay timers de handshake ni de idle. */
+static uint64_t now_ms(void){ struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
   return (uint64_t)ts.tv_sec*1000ull + (uint64_t)(ts.tv_nsec/1000000ull); }
+// now_us: igual en microsegundos (muestras de RTT).
+static uint64_t now_us(void){ struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec*1000000ull + (uint64_t)(ts.tv_nsec/1000ull); }
 
-/* mq_pack / mq_unpack:
+/* mq_pack / mq_parse:
    - Serializan y deserializan el header + topic + data en un buffer.
    - Se usan conversiones de orden de bytes (htonl/htons) para red.
    - En QUIC existen formats binarios y frames; esto es un análogo simplificado. */
 static size_t mq_pack(uint8_t* b, size_t bl, const mq_packet_t* p){
-  if (bl < sizeof(mq_hdr_t)) return 0;
-  mq_hdr_t h=p->hdr; h.seq=htonl(h.seq); h.ack=htonl(h.ack);
+  if (bl < sizeof(mq_hdr_t)+8) return 0;
+  mq_hdr_t h=p->hdr; h.type|=MQ_HDR_CID; h.seq=htonl(h.seq); h.ack=htonl(h.ack);
   h.topic_len=htons(h.topic_len); h.data_len=htons(h.data_len);
   memcpy(b,&h,sizeof(h)); size_t off=sizeof(h);
+  for(int i=0;i<8;i++) b[off++]=(uint8_t)(p->cid>>(56-8*i));   // siempre con CID
   if (p->hdr.topic_len){ if (off+p->hdr.topic_len>bl) return 0; memcpy(b+off,p->topic,p->hdr.topic_len); off+=p->hdr.topic_len; }
   if (p->hdr.data_len){ if (off+p->hdr.data_len>bl) return 0; memcpy(b+off,p->data,p->hdr.data_len); off+=p->hdr.data_len; }
   return off;
 }
-static bool mq_unpack(const uint8_t* b, size_t l, mq_packet_t* o){
-  if (l<sizeof(mq_hdr_t)) return false; memcpy(&o->hdr,b,sizeof(mq_hdr_t));
-  o->hdr.seq=ntohl(o->hdr.seq); o->hdr.ack=ntohl(o->hdr.ack);
-  o->hdr.topic_len=ntohs(o->hdr.topic_len); o->hdr.data_len=ntohs(o->hdr.data_len);
+/* mq_view_t / mq_parse: vista sin copias de un datagrama recibido. Valida la
+   cabecera y las longitudes; topic y data apuntan dentro del buffer original
+   (el topic NO termina en '\0': usar hdr.topic_len). */
+typedef struct { mq_hdr_t hdr; bool has_cid; uint64_t cid; const char* topic; const uint8_t* data; } mq_view_t;
+static bool mq_parse(const uint8_t* b, size_t l, mq_view_t* v){
+  if (l<sizeof(mq_hdr_t)) return false;
+  memcpy(&v->hdr,b,sizeof(mq_hdr_t));
+  v->hdr.seq=ntohl(v->hdr.seq); v->hdr.ack=ntohl(v->hdr.ack);
+  v->hdr.topic_len=ntohs(v->hdr.topic_len); v->hdr.data_len=ntohs(v->hdr.data_len);
   size_t off=sizeof(mq_hdr_t);
-  if (o->hdr.topic_len){ if (off+o->hdr.topic_len>l || o->hdr.topic_len>=sizeof(o->topic)) return false;
-    memcpy(o->topic,b+off,o->hdr.topic_len); o->topic[o->hdr.topic_len]='\0'; off+=o->hdr.topic_len; }
-  else o->topic[0]='\0';
-  if (o->hdr.data_len){ if (off+o->hdr.data_len>l || o->hdr.data_len>MQ_MAX_PAYLOAD) return false;
-    memcpy(o->data,b+off,o->hdr.data_len); }
+  v->has_cid=v->hdr.type&MQ_HDR_CID; v->hdr.type&=MQ_TYPE_MASK; v->cid=0;
+  if (v->has_cid){ if (l<off+8) return false; for(int i=0;i<8;i++) v->cid=v->cid<<8|b[off++]; }
+  if (v->hdr.topic_len>=sizeof(((mq_packet_t*)0)->topic) || off+v->hdr.topic_len>l) return false;
+  v->topic=(const char*)b+off; off+=v->hdr.topic_len;
+  if (v->hdr.data_len>MQ_MAX_PAYLOAD || off+v->hdr.data_len>l) return false;
+  v->data=b+off;
   return true;
 }
+// Sólo vale lo que llega del broker y, si trae CID, con el nuestro (no basta con que cuadre el ack).
+static bool mq_from_srv(const struct sockaddr_in* fr, const struct sockaddr_in* srv, uint64_t cid, const mq_view_t* v){
+  return fr->sin_addr.s_addr==srv->sin_addr.s_addr && fr->sin_port==srv->sin_port && (!v->has_cid || v->cid==cid); }
+// mq_new_cid: CID aleatorio para una conexión (bit alto reservado por el broker).
+static uint64_t mq_new_cid(void){
+  uint64_t c; if(getrandom(&c,sizeof(c),0)!=(ssize_t)sizeof(c)) c=now_us()^((uint64_t)getpid()<<32)^(uint64_t)(uintptr_t)&c;
+  return c&~(1ull<<63); }
+
+/* --- Frames ACK con rangos (estilo QUIC) ---
+   data de un MQ_ACK: ack_delay_us (u32) | n (u8) | first_len (u32) | (n-1) x { gap (u32), len (u32) },
+   hdr.ack = mayor seq confirmado. Primer rango [largest-first_len, largest]; cada
+   rango siguiente empieza 'gap' seqs ausentes por debajo del anterior y cubre len+1.
+   Un MQ_ACK sin data es el ACK simple de antes (un solo seq en hdr.ack). */
+#define MQ_ACK_MAX_RANGES 32
+typedef struct { uint32_t lo, hi; } mq_range_t;                               // [lo, hi]
+typedef struct { int n; mq_range_t r[MQ_ACK_MAX_RANGES]; } mq_rangeset_t;     // descendente, disjuntos
+typedef struct { uint32_t ack_delay_us; mq_rangeset_t rs; } mq_ackframe_t;
+
+static bool rs_contains(const mq_rangeset_t* rs, uint32_t seq){
+  for(int i=0;i<rs->n;i++){ if(seq>rs->r[i].hi) return false; if(seq>=rs->r[i].lo) return true; }
+  return false;
+}
+static void put_u32(uint8_t* b, uint32_t v){ v=htonl(v); memcpy(b,&v,4); }
+static uint32_t get_u32(const uint8_t* b){ uint32_t v; memcpy(&v,b,4); return ntohl(v); }
+
+static size_t mq_ack_encode(uint8_t* b, size_t bl, const mq_ackframe_t* f){
+  size_t off=9; if(f->rs.n<1 || off+(size_t)(f->rs.n-1)*8>bl) return 0;
+  put_u32(b,f->ack_delay_us); b[4]=(uint8_t)f->rs.n; put_u32(b+5,f->rs.r[0].hi-f->rs.r[0].lo);
+  for(int i=1;i<f->rs.n;i++){ put_u32(b+off,f->rs.r[i-1].lo-f->rs.r[i].hi-1); put_u32(b+off+4,f->rs.r[i].hi-f->rs.r[i].lo); off+=8; }
+  return off;
+}
+// Extrae el frame de un MQ_ACK (con rangos o simple).
+static bool mq_ack_parse(const mq_view_t* p, mq_ackframe_t* f){
+  if(p->hdr.type!=MQ_ACK) return false;
+  if(!p->hdr.data_len){ f->ack_delay_us=0; f->rs.n=1; f->rs.r[0].lo=f->rs.r[0].hi=p->hdr.ack; return true; }
+  const uint8_t* b=p->data; size_t len=p->hdr.data_len; if(len<9) return false;
+  int n=b[4]; if(n<1 || n>MQ_ACK_MAX_RANGES || len<9+(size_t)(n-1)*8) return false;
+  f->ack_delay_us=get_u32(b); uint32_t hi=p->hdr.ack, span=get_u32(b+5); if(span>hi) return false;
+  f->rs.r[0].hi=hi; f->rs.r[0].lo=hi-span;
+  for(int i=1;i<n;i++){ uint32_t gap=get_u32(b+9+(i-1)*8), l=get_u32(b+13+(i-1)*8), plo=f->rs.r[i-1].lo;
+    if(gap>=plo) return false;
+    hi=plo-gap-1; if(l>hi) return false;
+    f->rs.r[i].hi=hi; f->rs.r[i].lo=hi-l; }
+  f->rs.n=n; return true;
+}
 
 /* mq_send_ack:
-   - Construye y envía un paquete MQ_ACK con el número de ack indicado.
-   - En QUIC los ACKs son frames que pueden incluir ranges y delays; aquí es un
-   - ACK simple que contiene el número confirmado. */
-static int mq_send_ack(int s, const struct sockaddr_in* a, socklen_t al, uint32_t ack){
-  mq_packet_t p={0}; p.hdr.type=MQ_ACK; p.hdr.ack=ack; uint8_t buf[64]; size_t n=mq_pack(buf,sizeof(buf),&p);
+   - Construye y envía un paquete MQ_ACK con los rangos del frame.
+   - En QUIC los ACKs son frames que pueden incluir ranges y delays; aquí el
+   - frame viaja en el campo data del MQ_ACK (ver mq_ack_encode). */
+static int mq_send_ack(int s, const struct sockaddr_in* a, socklen_t al, uint64_t cid, const mq_ackframe_t* f){
+  mq_packet_t p={0}; p.hdr.type=MQ_ACK; p.cid=cid; p.hdr.ack=f->rs.r[0].hi;
+  p.hdr.data_len=(uint16_t)mq_ack_encode(p.data,sizeof(p.data),f); if(!p.hdr.data_len) return -1;
+  uint8_t buf[1600]; size_t n=mq_pack(buf,sizeof(buf),&p);
   return (sendto(s,buf,n,0,(const struct sockaddr*)a,al)<0)?-1:0;
 }
 
+/* --- Estimación de RTT y PTO adaptativo (RFC 9002 §5-6) ---
+   En vez de un timeout fijo de 500 ms (~1000x el RTT de loopback/LAN) se mide el
+   RTT con cada ACK de un paquete enviado una sola vez (Karn) y se suaviza:
+   srtt = 7/8 srtt + 1/8 muestra, rttvar = 3/4 rttvar + 1/4 |srtt - muestra|,
+   descontando el ack_delay que reporta el peer. PTO = srtt + max(4*rttvar, 1 ms)
+   + max_ack_delay, duplicado por cada PTO consecutivo sin respuesta. Mientras no
+   hay muestras se usa MQ_TIMEOUT_MS. */
+#define MQ_GRANULARITY_US    1000  // resolución mínima del timer
+#define MQ_MAX_ACK_DELAY_MS  25    // ack_delay supuesto del peer hasta que reporte otro
+#define MQ_MAX_PTO_MS        4000  // tope del PTO con backoff
+
+typedef struct { uint64_t latest_us, min_rtt_us, srtt_us, rttvar_us, max_ack_delay_us; bool has_sample; int pto_count; } mq_rtt_t;
+
+static void rtt_init(mq_rtt_t* r){ memset(r,0,sizeof(*r)); r->max_ack_delay_us=MQ_MAX_ACK_DELAY_MS*1000ull; }
+static void rtt_on_sample(mq_rtt_t* r, uint64_t sample_us, uint64_t ack_delay_us){
+  if(ack_delay_us>r->max_ack_delay_us && ack_delay_us<MQ_MAX_PTO_MS*1000ull) r->max_ack_delay_us=ack_delay_us;
+  r->latest_us=sample_us;
+  if(!r->has_sample || sample_us<r->min_rtt_us) r->min_rtt_us=sample_us;
+  if(!r->has_sample){ r->srtt_us=sample_us; r->rttvar_us=sample_us/2; r->has_sample=true; return; }
+  uint64_t adj=sample_us; if(adj>=r->min_rtt_us+ack_delay_us) adj-=ack_delay_us;   // nunca por debajo de min_rtt
+  uint64_t dev=r->srtt_us>adj?r->srtt_us-adj:adj-r->srtt_us;
+  r->rttvar_us=(3*r->rttvar_us+dev)/4; r->srtt_us=(7*r->srtt_us+adj)/8;
+}
+static uint64_t rtt_pto_ms(const mq_rtt_t* r){
+  uint64_t pto=MQ_TIMEOUT_MS*1000ull;
+  if(r->has_sample){ uint64_t v=4*r->rttvar_us; pto=r->srtt_us+(v>MQ_GRANULARITY_US?v:MQ_GRANULARITY_US)+r->max_ack_delay_us; }
+  pto<<=(r->pto_count<16?r->pto_count:16);
+  uint64_t ms=(pto+999)/1000; return ms<MQ_MAX_PTO_MS?ms:MQ_MAX_PTO_MS;
+}
+
 /* mq_send_reliable:
    - Implementa envío fiable en espacio de usuario:
      1) Serializa el paquete y lo envía por UDP.
-     2) Espera un ACK que contenga p->hdr.seq usando select() con timeout.
-     3) Si no llega ACK en MQ_TIMEOUT_MS retransmite, hasta MQ_MAX_RETX intentos.
+     2) Espera un ACK que contenga p->hdr.seq usando poll() con timeout.
+     3) Si no llega ACK en un PTO (rtt_pto_ms) retransmite, hasta MQ_MAX_RETX intentos.
    - Simula la lógica básica de retransmisión de QUIC, pero sin detección de pérdida
-     por reordenamiento, sin timers adaptativos complejos y sin contención.
-   - Observaciones: el uso de select() aquí bloquea hasta recibir algo en el socket;
+     por reordenamiento y sin contención.
+   - Observaciones: el uso de poll() aquí bloquea hasta recibir algo en el socket;
      en implementaciones más complejas habría un loop de eventos centralizado. */
-static int mq_send_reliable(int s, const struct sockaddr_in* a, socklen_t al, mq_packet_t* p){
+static int mq_send_reliable(int s, const struct sockaddr_in* a, socklen_t al, mq_packet_t* p, mq_rtt_t* rtt){
   uint8_t buf[1600]; size_t n=mq_pack(buf,sizeof(buf),p); if(!n) return -1; int tries=0;
   while(tries<MQ_MAX_RETX){
     if (sendto(s,buf,n,0,(const struct sockaddr*)a,al)<0){ perror("sendto"); return -1; }
-    uint64_t start=now_ms();
+    uint64_t start=now_ms(), start_us=now_us(), pto=rtt_pto_ms(rtt);
     for(;;){
-      uint64_t el=now_ms()-start; if(el>=MQ_TIMEOUT_MS) break;
-      struct timeval tv={.tv_sec=(MQ_TIMEOUT_MS-el)/1000,.tv_usec=((MQ_TIMEOUT_MS-el)%1000)*1000};
-      fd_set f; FD_ZERO(&f); FD_SET(s,&f);
-      int r=select(s+1,&f,NULL,NULL,&tv);
-      if(r>0 && FD_ISSET(s,&f)){
+      uint64_t el=now_ms()-start; if(el>=pto) break;
+      struct pollfd pf={ .fd=s, .events=POLLIN };
+      int r=poll(&pf,1,(int)(pto-el));
+      if(r>0){
         uint8_t rb[1600]; struct sockaddr_in fr; socklen_t fl=sizeof(fr);
         ssize_t rn=recvfrom(s,rb,sizeof(rb),0,(struct sockaddr*)&fr,&fl);
-        if(rn>0){ mq_packet_t ap; if(mq_unpack(rb,rn,&ap)&&ap.hdr.type==MQ_ACK&&ap.hdr.ack==p->hdr.seq) return 0; }
-      } else if (r<0 && errno!=EINTR){ perror("select"); break; }
+        if(rn>0){ mq_view_t ap; mq_ackframe_t af;
+          if(mq_parse(rb,rn,&ap)&&mq_from_srv(&fr,a,p->cid,&ap)&&mq_ack_parse(&ap,&af)&&rs_contains(&af.rs,p->hdr.seq)){
+            if(!tries) rtt_on_sample(rtt,now_us()-start_us,af.ack_delay_us);
+            rtt->pto_count=0; return 0; } }
+      } else if (r<0 && errno!=EINTR){ perror("poll"); break; }
     }
-    tries++;
+    tries++; rtt->pto_count++;
   }
   fprintf(stderr,"[pub] timeout esperando ACK seq=%u\n", p->hdr.seq); return -1;
 }
 
-/* main:
-   - Args: <host> <port> <topic> <num_msgs>
-   - Crea socket UDP y envía:
-       HELLO (no bloqueante de ACK aquí)
-       PUB(topic) con seq=1 de forma fiable (mq_send_reliable)
-       N mensajes DATA con seq=2..N+1 de forma fiable
-   - Secuencia de números: simple contador secuencial usado para ACK matching.
-   - En diseño real de QUIC, la numeración y espacios de números son más complejos. */
-int main(int argc, char** argv){
-  if(argc<5){ fprintf(stderr,"Uso: %s <host> <port> <topic> <num_msgs>\n",argv[0]); return 1; }
-  const char* host=argv[1]; int port=atoi(argv[2]); const char* topic=argv[3]; int num=atoi(argv[4]);
+/* --- Ventana deslizante con repetición selectiva ---
+   Sustituye al stop-and-wait (ventana = 1) para los DATA: hasta 'size' paquetes
+   en vuelo a la vez, cada uno con su propio instante de envío y contador de
+   reintentos. Un ACK confirma sólo su seq (puede llegar fuera de orden) y la base
+   de la ventana avanza cuando el paquete más antiguo queda confirmado. Al vencer
+   el timeout se retransmite únicamente el seq perdido, no toda la ventana.
+   Los seq son consecutivos, así que cada uno ocupa la ranura seq % size.
+   Con ACKs por rangos, un seq sin confirmar enviado MQ_PKT_THRESHOLD envíos antes
+   que el mayor confirmado se retransmite sin esperar el timeout ('tx' numera cada
+   envío, incluidas retransmisiones, como los packet numbers de QUIC).
+   Pacing (opción -p): en vez de vaciar la ventana de golpe, los DATA nuevos salen
+   espaciados srtt / (MQ_PACING_GAIN * size) µs, es decir al ritmo de una ventana
+   por RTT; la espera se hace en el mismo ppoll() con resolución de µs.
+   Ritmo objetivo (opción -R, modo carga): además, un DATA nuevo cada 1/R s; si
+   el ppoll() despierta tarde se recupera el retraso con ráfagas de hasta
+   MQ_RATE_BURST mensajes, de modo que el ritmo medio se mantiene.
+   En modo carga la ventana guarda además la latencia de cada DATA (primer envío
+   -> ACK, µs) para calcular percentiles al final. */
+#define MQ_DEFAULT_WINDOW 32   // paquetes DATA en vuelo (opción -w)
+#define MQ_MAX_WINDOW     1024 // tope de -w: la ventana anti-duplicados del broker (MQ_DEDUP_WINDOW)
+#define MQ_PKT_THRESHOLD  3    // reordenamiento tolerado antes de dar un seq por perdido
+#define MQ_PACING_GAIN    1.25 // ritmo = 1.25 * ventana / srtt (opción -p)
+#define MQ_RATE_BURST     32   // mensajes de retraso recuperables de golpe (opción -R)
+
+typedef struct { uint32_t seq; uint64_t first_us, sent_us, deadline, tx; int tries; bool acked; size_t len; uint8_t buf[1600]; } mq_slot_t;
+typedef struct { mq_slot_t* slot; uint32_t size, base, next; uint64_t tx_count, largest_acked_tx; mq_rtt_t* rtt;
+                 bool pacing; uint64_t pace_next_us; unsigned long retx;
+                 double rate_gap_us, rate_next_us;             // ritmo objetivo (0 = sin límite)
+                 bool load; uint32_t* lat; size_t nlat, lcap;   // modo carga: latencias de ACK (µs)
+                 bool trace;                                    // -v: una línea por DATA confirmado
+               } mq_window_t;  // [base,next) en vuelo
+
+static bool win_init(mq_window_t* w, uint32_t size, uint32_t first_seq, mq_rtt_t* rtt){
+  w->slot=calloc(size,sizeof(mq_slot_t)); w->size=size; w->base=w->next=first_seq;
+  w->tx_count=w->largest_acked_tx=0; w->rtt=rtt; w->pacing=false; w->pace_next_us=0; w->retx=0;
+  w->rate_gap_us=w->rate_next_us=0; w->load=false; w->trace=false; w->lat=NULL; w->nlat=w->lcap=0; return w->slot!=NULL;
+}
+// µs que faltan para poder enviar un DATA nuevo según el pacing y el ritmo objetivo (0 = ya).
+static uint64_t win_pace_wait_us(const mq_window_t* w){
+  uint64_t t=now_us(), next=0;
+  if(w->pacing && w->rtt->has_sample) next=w->pace_next_us;
+  if(w->rate_gap_us>0 && (uint64_t)w->rate_next_us>next) next=(uint64_t)w->rate_next_us;
+  return next>t ? next-t : 0;
+}
+static bool win_can_send(const mq_window_t* w){ return w->next-w->base < w->size; }
+static bool win_empty(const mq_window_t* w){ return w->base==w->next; }
+
+static void win_xmit(int s, const struct sockaddr_in* a, socklen_t al, mq_window_t* w, mq_slot_t* sl){
+  if (sendto(s,sl->buf,sl->len,0,(const struct sockaddr*)a,al)<0) perror("sendto");
+  sl->sent_us=now_us(); if(!sl->tries) sl->first_us=sl->sent_us; sl->deadline=now_ms()+rtt_pto_ms(w->rtt); if(sl->tries++) w->retx++; sl->tx=++w->tx_count;
+}
+// Ocupa la siguiente ranura con p (p->hdr.seq se asigna aquí) y lo envía.
+static int win_send(int s, const struct sockaddr_in* a, socklen_t al, mq_window_t* w, mq_packet_t* p){
+  mq_slot_t* sl=&w->slot[w->next % w->size]; p->hdr.seq=w->next;
+  sl->len=mq_pack(sl->buf,sizeof(sl->buf),p); if(!sl->len) return -1;
+  sl->seq=w->next; sl->tries=0; sl->acked=false; w->next++;
+  win_xmit(s,a,al,w,sl);
+  if(w->pacing && w->rtt->has_sample){ uint64_t t=sl->sent_us>w->pace_next_us?sl->sent_us:w->pace_next_us;
+    w->pace_next_us=t+(uint64_t)((double)w->rtt->srtt_us/(MQ_PACING_GAIN*w->size)); }
+  if(w->rate_gap_us>0){ double lo=(double)sl->sent_us-MQ_RATE_BURST*w->rate_gap_us;
+    if(w->rate_next_us<lo) w->rate_next_us=lo;
+    w->rate_next_us+=w->rate_gap_us; }
+  return 0;
+}
+// Modo carga: guarda una latencia de ACK (la tabla crece al doble cuando se llena).
+static void win_lat_add(mq_window_t* w, uint64_t us){
+  if(w->nlat==w->lcap){
+    size_t nc=w->lcap?2*w->lcap:4096; uint32_t* nl=realloc(w->lat,nc*sizeof(*nl)); if(!nl) return;
+    w->lat=nl; w->lcap=nc;
+  }
+  w->lat[w->nlat++]=us>UINT32_MAX?UINT32_MAX:(uint32_t)us;
+}
+// Aplica un frame ACK: confirma los seq cubiertos y retransmite los que sus huecos delatan.
+static void win_on_ack(int s, const struct sockaddr_in* a, socklen_t al, mq_window_t* w, const mq_ackframe_t* f){
+  bool any=false; uint64_t best_tx=0, sample_us=0;
+  for (uint32_t q=w->base; q!=w->next; q++){
+    mq_slot_t* sl=&w->slot[q % w->size]; if (sl->acked || !rs_contains(&f->rs,q)) continue;
+    sl->acked=true; any=true;
+    if (w->load) win_lat_add(w,now_us()-sl->first_us); else if (w->trace) printf("[pub] enviado seq=%u\n", q);
+    if (sl->tx>best_tx){ best_tx=sl->tx; sample_us=sl->tries==1?now_us()-sl->sent_us:0; }  // muestra del más reciente
+    if (sl->tx>w->largest_acked_tx) w->largest_acked_tx=sl->tx;
+  }
+  if (!any) return;
+  if (sample_us) rtt_on_sample(w->rtt,sample_us,f->ack_delay_us);
+  w->rtt->pto_count=0;
+  for (uint32_t q=w->base; q!=w->next; q++){
+    mq_slot_t* sl=&w->slot[q % w->size];
+    if (!sl->acked && sl->tx+MQ_PKT_THRESHOLD<=w->largest_acked_tx && sl->tries<MQ_MAX_RETX) win_xmit(s,a,al,w,sl);
+  }
+  while (!win_empty(w) && w->slot[w->base % w->size].acked) w->base++;
+}
+// Retransmite los seq vencidos; -1 si alguno agotó MQ_MAX_RETX. Devuelve en *tmo los ms al próximo vencimiento.
+static int win_on_timer(int s, const struct sockaddr_in* a, socklen_t al, mq_window_t* w, int* tmo){
+  uint64_t now=now_ms(); *tmo=-1;
+  for (uint32_t q=w->base; q!=w->next; q++){
+    mq_slot_t* sl=&w->slot[q % w->size]; if (sl->acked) continue;
+    if (now>=sl->deadline){
+      if (sl->tries>=MQ_MAX_RETX){ fprintf(stderr,"[pub] timeout esperando ACK seq=%u\n", sl->seq); return -1; }
+      if (q==w->base) w->rtt->pto_count++;   // backoff: un paso por episodio, no por ranura
+      win_xmit(s,a,al,w,sl);
+    }
+    int left=(int)(sl->deadline-now); if (*tmo<0 || left<*tmo) *tmo=left;
+  }
+  return 0;
+}
+/* --- Conexiones simuladas e hilos (opciones -N/-M) ---
+   Cada conexión es un publisher completo: socket UDP propio (con su puerto
+   efímero, así el kernel reparte los ACK por socket y no hay que demultiplexar
+   en usuario), CID, RTT, ventana y tópico. Cada hilo atiende sus M conexiones en
+   un único bucle ppoll(): rellena las ventanas, vence los timers y drena los ACK
+   de los sockets listos. Los hilos no comparten estado; la configuración es de
+   sólo lectura y los resultados se suman en main tras pthread_join(). */
+typedef struct {
+  struct sockaddr_in srv; int window, size; bool pacing, load, verbose, trace;
+  double rate_gap_us, dur;      // por conexión
+} mq_cfg_t;
+static mq_cfg_t cfg;
 
-  int s=socket(AF_INET,SOCK_DGRAM,0); if(s<0){ perror("socket"); return 1; }
-  struct sockaddr_in srv={0}; srv.sin_family=AF_INET; srv.sin_port=htons(port);
-  if(inet_pton(AF_INET,host,&srv.sin_addr)!=1){ fprintf(stderr,"Dirección inválida\n"); return 1; }
+typedef struct {
+  int s; uint64_t cid; char topic[128];
+  mq_rtt_t rtt; mq_window_t w; mq_packet_t d;
+  int i, num; uint64_t t0, t1, end_us; bool more, done, failed;
+} mq_pubconn_t;
+
+typedef struct { mq_pubconn_t* c; int n; pthread_t th; } mq_worker_t;
+
+// Abre la conexión: socket, HELLO y PUB(topic) fiable; después prepara la ventana.
+static int conn_open(mq_pubconn_t* c){
+  c->s=socket(AF_INET,SOCK_DGRAM,0); if(c->s<0){ perror("socket"); return -1; }
+  c->cid=mq_new_cid(); rtt_init(&c->rtt);   // RTT/PTO del camino al broker (PUB y DATA)
 
   // HELLO
   // En QUIC aquí habría un handshake CRYPTO/TLS; aquí solo un saludo sin criptografía.
-  mq_packet_t hello={0}; hello.hdr.type=MQ_HELLO; uint8_t hb[64]; size_t hn=mq_pack(hb,sizeof(hb),&hello);
-  sendto(s,hb,hn,0,(struct sockaddr*)&srv,sizeof(srv));
+  mq_packet_t hello={0}; hello.hdr.type=MQ_HELLO; hello.cid=c->cid; uint8_t hb[64]; size_t hn=mq_pack(hb,sizeof(hb),&hello);
+  sendto(c->s,hb,hn,0,(struct sockaddr*)&cfg.srv,sizeof(cfg.srv));
 
   // PUB(topic) seq=1 -> envío fiable (wait for ACK)
-  mq_packet_t pub={0}; pub.hdr.type=MQ_PUB; pub.hdr.seq=1;
-  pub.hdr.topic_len=(uint16_t)strlen(topic); strncpy(pub.topic,topic,sizeof(pub.topic)-1);
-  if(mq_send_reliable(s,&srv,sizeof(srv),&pub)!=0){ fprintf(stderr,"Fallo al anunciar PUB\n"); return 1; }
-  printf("[pub] publicando en '%s'\n", topic);
+  mq_packet_t pub={0}; pub.hdr.type=MQ_PUB; pub.hdr.seq=1; pub.cid=c->cid;
+  pub.hdr.topic_len=(uint16_t)strlen(c->topic); memcpy(pub.topic,c->topic,pub.hdr.topic_len);
+  if(mq_send_reliable(c->s,&cfg.srv,sizeof(cfg.srv),&pub,&c->rtt)!=0){ fprintf(stderr,"Fallo al anunciar PUB en '%s'\n",c->topic); return -1; }
+  if(cfg.verbose) printf("[pub] publicando en '%s' (cid=%016llx)\n", c->topic, (unsigned long long)c->cid);
 
-  // DATA seq=2..N+1 -> cada DATA se envía de forma fiable (mq_send_reliable)
+  // DATA seq=2..N+1 -> ventana deslizante: se llenan los huecos libres y se
+  // esperan ACKs (o timeouts) hasta que todo quede confirmado.
   // En QUIC los STREAM frames permiten enviar datos de forma multiplexada y con
   // offsets; aquí cada DATA es un paquete independiente con seq propio.
-  for(int i=0;i<num;i++){
-    char msg[128]; snprintf(msg,sizeof(msg),"hello #%d", i+1);
-    mq_packet_t d={0}; d.hdr.type=MQ_DATA; d.hdr.seq=(uint32_t)(2+i);
-    d.hdr.topic_len=(uint16_t)strlen(topic); d.hdr.data_len=(uint16_t)strlen(msg);
-    strncpy(d.topic,topic,sizeof(d.topic)-1); memcpy(d.data,msg,d.hdr.data_len);
-    if(mq_send_reliable(s,&srv,sizeof(srv),&d)!=0){ fprintf(stderr,"Fallo DATA #%d\n",i+1); break; }
-    printf("[pub] enviado seq=%u\n", d.hdr.seq);
+  if(!win_init(&c->w,(uint32_t)cfg.window,2,&c->rtt)){ perror("calloc"); return -1; }
+  c->w.pacing=cfg.pacing; c->w.load=cfg.load; c->w.trace=cfg.trace; c->w.rate_gap_us=cfg.rate_gap_us;
+  c->d.hdr.type=MQ_DATA; c->d.cid=c->cid;
+  c->d.hdr.topic_len=pub.hdr.topic_len; memcpy(c->d.topic,c->topic,pub.hdr.topic_len);
+  if(cfg.load){ c->d.hdr.data_len=(uint16_t)cfg.size; for(int k=0;k<cfg.size;k++) c->d.data[k]=(uint8_t)('a'+k%26); }
+  c->t0=now_us(); c->end_us=cfg.dur>0?c->t0+(uint64_t)(cfg.dur*1e6):0;
+  c->more=c->num>0 || c->end_us;
+  return 0;
+}
+// Envía los DATA nuevos que permitan la ventana, el pacing y el ritmo objetivo.
+static void conn_fill(mq_pubconn_t* c){
+  while(c->more && win_can_send(&c->w) && !win_pace_wait_us(&c->w)){
+    if(!cfg.load){ char msg[128]; snprintf(msg,sizeof(msg),"hello #%d", c->i+1);
+      c->d.hdr.data_len=(uint16_t)strlen(msg); memcpy(c->d.data,msg,c->d.hdr.data_len); }
+    else if(cfg.size>=8){ uint64_t t=now_us(); put_u32(c->d.data,(uint32_t)(t>>32)); put_u32(c->d.data+4,(uint32_t)t); }
+    if(win_send(c->s,&cfg.srv,sizeof(cfg.srv),&c->w,&c->d)!=0){ fprintf(stderr,"Fallo DATA #%d\n",c->i+1); c->more=false; break; }
+    if(++c->i==c->num) c->more=false;
   }
+  if(c->more && c->end_us && now_us()>=c->end_us) c->more=false;
+}
+// Aplica todos los ACK pendientes en el socket de la conexión.
+static void conn_rx(mq_pubconn_t* c){
+  for(;;){
+    uint8_t rb[1600]; struct sockaddr_in fr; socklen_t fl=sizeof(fr);
+    ssize_t rn=recvfrom(c->s,rb,sizeof(rb),MSG_DONTWAIT,(struct sockaddr*)&fr,&fl);
+    if(rn<0) break;
+    mq_view_t ap; mq_ackframe_t af;
+    if(mq_parse(rb,rn,&ap) && mq_from_srv(&fr,&cfg.srv,c->cid,&ap) && mq_ack_parse(&ap,&af)) win_on_ack(c->s,&cfg.srv,sizeof(cfg.srv),&c->w,&af);
+  }
+}
+// Bucle de un hilo: espera ACKs (o el próximo timeout, o el turno del pacing de
+// alguna conexión) y los aplica, hasta que todas sus conexiones terminan.
+static void* worker_run(void* arg){
+  mq_worker_t* wk=arg;
+  struct pollfd* pf=calloc(wk->n,sizeof(*pf)); if(!pf){ perror("calloc"); return NULL; }
+  for(int k=0;k<wk->n;k++){ mq_pubconn_t* c=&wk->c[k];
+    if(conn_open(c)!=0){ c->failed=c->done=true; pf[k].fd=-1; } else { pf[k].fd=c->s; pf[k].events=POLLIN; } }
+  for(;;){
+    int active=0; int64_t us=-1;
+    for(int k=0;k<wk->n;k++){ mq_pubconn_t* c=&wk->c[k]; if(c->done) continue;
+      conn_fill(c);
+      int tmo; if(win_on_timer(c->s,&cfg.srv,sizeof(cfg.srv),&c->w,&tmo)!=0){
+        fprintf(stderr,"Fallo DATA seq=%u\n",c->w.base); c->failed=true; }
+      if(c->failed || (!c->more && win_empty(&c->w))){ c->done=true; c->t1=now_us(); pf[k].fd=-1; continue; }
+      active++;
+      int64_t cu=tmo<0?-1:(int64_t)tmo*1000;
+      if(c->more && win_can_send(&c->w)){ int64_t pw=(int64_t)win_pace_wait_us(&c->w); if(cu<0 || pw<cu) cu=pw; }
+      if(cu>=0 && (us<0 || cu<us)) us=cu;
+    }
+    if(!active) break;
+    struct timespec ts={.tv_sec=us/1000000,.tv_nsec=(us%1000000)*1000};
+    int r=ppoll(pf,wk->n,us<0?NULL:&ts,NULL);
+    if(r<0 && errno!=EINTR){ perror("ppoll"); break; }
+    for(int k=0;r>0 && k<wk->n;k++) if(pf[k].fd>=0 && (pf[k].revents&POLLIN)) conn_rx(&wk->c[k]);
+  }
+  free(pf);
+  return NULL;
+}
+
+static int cmp_u32(const void* a, const void* b){ uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b; return (x>y)-(x<y); }
+// Percentil q (0..1) de v ya ordenado, en ms.
+static double lat_pct_ms(const uint32_t* v, size_t n, double q){ return n ? v[(size_t)(q*(n-1))]/1000.0 : 0.0; }
+
+/* main:
+   - Args: <host> <port> <topic> <num_msgs> [-w ventana (hasta MQ_MAX_WINDOW)] [-p] [-s bytes] [-R msgs/s]
+           [-T segundos] [-N hilos] [-M conexiones_por_hilo] [-K tópicos]
+   - Crea socket UDP y envía:
+       HELLO (no bloqueante de ACK aquí)
+       PUB(topic) con seq=1 de forma fiable (mq_send_reliable)
+       N mensajes DATA con seq=2..N+1 de forma fiable, con hasta 'ventana'
+       paquetes en vuelo (mq_window_t)
+   - Modo carga (cualquiera de -s/-R/-T): los DATA llevan 'bytes' de payload (los 8
+     primeros, si caben, son el instante de envío en µs de CLOCK_MONOTONIC, en orden
+     de red), salen a R msgs/s (0 = lo que permita la ventana) y se generan hasta
+     num_msgs o hasta que pasen T segundos (num_msgs = 0: sin límite de cuenta).
+     No se imprime nada por mensaje; al final se informa del ritmo logrado, las
+     retransmisiones y los percentiles de la latencia de ACK.
+   - -v (fuera del modo carga): imprime una línea por cada DATA confirmado.
+   - Varias conexiones (-N/-M, implica modo carga): N hilos x M conexiones, cada una
+     con su socket y su CID. Con -K > 1 la conexión j publica en <topic>/(j % K)
+     (por defecto K = N*M); con K = 1 todas publican en <topic>. num_msgs y -R son
+     totales del proceso y se reparten a partes iguales entre las conexiones.
+   - Secuencia de números: contador por conexión publisher->broker, usado sólo para
+     casar ACKs (y para la deduplicación en el broker). Los suscriptores no lo ven:
+     el broker renumera cada DATA en el espacio de seq propio de cada suscriptor.
+   - En diseño real de QUIC, la numeración y espacios de números son más complejos. */
+int main(int argc, char** argv){
+  int opt, window=MQ_DEFAULT_WINDOW, size=-1, rate=0, nthr=1, per=1, ntop=0; double dur=0;
+  bool bad=false, pacing=false, load=false, trace=false;
+  while((opt=getopt(argc,argv,"w:ps:R:T:N:M:K:v"))!=-1){
+    if(opt=='w') window=atoi(optarg); else if(opt=='p') pacing=true; else if(opt=='v') trace=true;
+    else if(opt=='s'){ size=atoi(optarg); load=true; } else if(opt=='R'){ rate=atoi(optarg); load=true; }
+    else if(opt=='T'){ dur=atof(optarg); load=true; } else if(opt=='N') nthr=atoi(optarg);
+    else if(opt=='M') per=atoi(optarg); else if(opt=='K') ntop=atoi(optarg); else bad=true;
+  }
+  if(bad || argc-optind<4 || window<1 || window>MQ_MAX_WINDOW || size>MQ_MAX_PAYLOAD || rate<0 || dur<0 || nthr<1 || per<1 || ntop<0){
+    fprintf(stderr,"Uso: %s <host> <port> <topic> <num_msgs> [-w ventana (1..%d)] [-p] [-s bytes (0..%d)] [-R msgs/s]"
+                   " [-T segundos] [-N hilos] [-M conexiones_por_hilo] [-K tópicos] [-v]\n",argv[0],MQ_MAX_WINDOW,MQ_MAX_PAYLOAD); return 1; }
+  const char* host=argv[optind]; int port=atoi(argv[optind+1]); const char* topic=argv[optind+2]; int num=atoi(argv[optind+3]);
+  int nconn=nthr*per; if(nconn>1) load=true;
+  if(load && num<=0 && dur<=0){ fprintf(stderr,"Modo carga sin límite: indica num_msgs > 0 o -T\n"); return 1; }
+  if(load && size<0) size=64;
+  if(!ntop) ntop=nconn;
+
+  cfg.srv.sin_family=AF_INET; cfg.srv.sin_port=htons(port);
+  if(inet_pton(AF_INET,host,&cfg.srv.sin_addr)!=1){ fprintf(stderr,"Dirección inválida\n"); return 1; }
+  cfg.window=window; cfg.size=size; cfg.pacing=pacing; cfg.load=load; cfg.verbose=nconn==1; cfg.trace=trace && !load; cfg.dur=dur;
+  if(rate>0) cfg.rate_gap_us=1e6*nconn/rate;
+
+  mq_pubconn_t* conns=calloc(nconn,sizeof(*conns)); mq_worker_t* wk=calloc(nthr,sizeof(*wk));
+  if(!conns || !wk){ perror("calloc"); return 1; }
+  for(int j=0;j<nconn;j++){
+    if(ntop>1) snprintf(conns[j].topic,sizeof(conns[j].topic),"%s/%d",topic,j%ntop);
+    else snprintf(conns[j].topic,sizeof(conns[j].topic),"%s",topic);
+    conns[j].num=num>0 ? num/nconn+(j<num%nconn) : 0;
+  }
+  if(nconn>1) printf("[pub] %d hilos x %d conexiones sobre %d tópicos ('%s%s')\n", nthr, per, ntop<nconn?ntop:nconn, topic, ntop>1?"/<k>":"");
+  for(int t=0;t<nthr;t++){ wk[t].c=conns+t*per; wk[t].n=per; }
+  if(nthr==1) worker_run(&wk[0]);
+  else {
+    for(int t=0;t<nthr;t++) if(pthread_create(&wk[t].th,NULL,worker_run,&wk[t])!=0){ perror("pthread_create"); return 1; }
+    for(int t=0;t<nthr;t++) pthread_join(wk[t].th,NULL);
+  }
+
+  // Resultados: suma de todas las conexiones.
+  int sent=0, failed=0; unsigned long retx=0; unsigned long long txc=0; size_t nlat=0; uint64_t t0=0, t1=0;
+  for(int j=0;j<nconn;j++){ mq_pubconn_t* c=&conns[j];
+    sent+=c->i; retx+=c->w.retx; txc+=c->w.tx_count; nlat+=c->w.nlat; failed+=c->failed;
+    if(c->t0 && (!t0 || c->t0<t0)) t0=c->t0;
+    if(c->t1>t1) t1=c->t1;
+  }
+  if(load){
+    uint32_t* lat=malloc((nlat?nlat:1)*sizeof(*lat)); size_t off=0;
+    for(int j=0;lat && j<nconn;j++){ memcpy(lat+off,conns[j].w.lat,conns[j].w.nlat*sizeof(*lat)); off+=conns[j].w.nlat; }
+    if(!lat) nlat=0;
+    double el=t1>t0?(t1-t0)/1e6:0; char goal[32];
+    if(rate>0) snprintf(goal,sizeof(goal),"%d msg/s",rate); else snprintf(goal,sizeof(goal),"sin límite");
+    qsort(lat,nlat,sizeof(*lat),cmp_u32);
+    printf("[pub] carga: %zu DATA confirmados de %d B en %.3f s -> %.0f msg/s, %.2f MB/s (objetivo %s, ventana %d)\n",
+           nlat, size, el, el>0?nlat/el:0.0, el>0?nlat*(double)size/el/1e6:0.0, goal, window);
+    printf("[pub] retransmisiones: %lu de %llu envíos (%.3f%%)\n", retx, txc, txc?100.0*retx/txc:0.0);
+    printf("[pub] latencia ACK: p50=%.3f ms p90=%.3f ms p99=%.3f ms p99.9=%.3f ms max=%.3f ms\n",
+           lat_pct_ms(lat,nlat,0.5), lat_pct_ms(lat,nlat,0.9), lat_pct_ms(lat,nlat,0.99),
+           lat_pct_ms(lat,nlat,0.999), lat_pct_ms(lat,nlat,1.0));
+    free(lat);
+  }
+  printf("[pub] %d DATA, %lu retransmisiones\n", sent, retx);
+  if(nconn==1){ const mq_rtt_t* rtt=&conns[0].rtt;
+    printf("[pub] rtt: srtt=%.3f ms rttvar=%.3f ms min=%.3f ms pto=%llu ms\n", rtt->srtt_us/1000.0,
+           rtt->rttvar_us/1000.0, rtt->min_rtt_us/1000.0, (unsigned long long)rtt_pto_ms(rtt)); }
+  else if(failed) printf("[pub] %d de %d conexiones fallaron\n", failed, nconn);
+  for(int j=0;j<nconn;j++){ free(conns[j].w.slot); free(conns[j].w.lat); if(conns[j].s>0) close(conns[j].s); }
+  free(conns); free(wk);
   (void)mq_send_ack; // silenciar warning si no se usa en este módulo
-  return 0;
+  return failed==nconn ? 1 : 0;
 }
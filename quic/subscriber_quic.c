@@ -10,14 +10,19 @@
 //    timeouts y ACKs (mq_send_reliable, MQ_ACK), emulando la idea de QUIC de
 //    desplegar la lógica de transporte fuera del kernel.
 //  - Numeración de paquetes (campo seq) y ACKs explícitos (campo ack).
-//  - Temporizadores (MQ_TIMEOUT_MS) para la retransmisión: equivalente simplificado
-//    a PTO/loss-detection de QUIC.
+//  - Temporizadores para la retransmisión: PTO calculado a partir del RTT medido
+//    (MQ_TIMEOUT_MS sólo hasta la primera muestra), como PTO/loss-detection de QUIC.
 // Diferencias importantes respecto a QUIC real:
 //  - No hay cifrado ni handshake TLS 1.3: HELLO/HELLO_OK es solo un saludo simple.
 //  - No hay multiplexación por streams: cada DATA es un mensaje independiente.
-//  - No hay control de congestión ni flow control (no CUBIC/BBR, no windowing).
-//  - No hay Connection IDs ni soporte de migración de path.
-//  - ACKs son simples (un único número confirmado), QUIC usa ranges y delays.
+//  - El control de congestión (NewReno/CUBIC), la ventana de envío y el pacing
+//    (-P lo pide) los aplica el broker hacia este suscriptor; aquí sólo hay una
+//    ventana de recepción para reordenar (-w), sin flow control negociado.
+//  - Connection ID aleatorio de 64 bits (header v2, bit 0x80): se descartan los
+//    paquetes con otro CID y el broker sigue a la conexión si cambia de dirección;
+//    no hay validación de path ni rotación de CIDs.
+//  - ACKs con rangos y ack_delay (frame MQ_ACK, ver mq_ack_encode), diferidos según
+//    -a/-d; a diferencia de QUIC no hay espacios de números separados ni ECN.
 //
 // Diferencia respecto a "Lab 3":
 //  - Si Lab 3 usaba TCP: en TCP la fiabilidad la aporta la pila kernel; aquí se
@@ -26,6 +31,7 @@
 //    básica (ACK + retries) similar conceptualmente a QUIC, pero sin las
 //    funcionalidades avanzadas.
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,140 +39,654 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/random.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_GRO
+#define UDP_GRO 104   // GRO: recibir datagramas agregados (linux/udp.h)
+#endif
 
 #define MQ_MAX_PAYLOAD 1200   // tamaño máximo de payload para que quepa en datagrama UDP
-#define MQ_TIMEOUT_MS  500    // timeout para esperar ACK (simulación simplificada de PTO)
+#define MQ_TIMEOUT_MS  500    // PTO inicial, mientras no hay muestras de RTT
 #define MQ_MAX_RETX    10     // retransmisiones máximas antes de considerar fallo
 
-typedef enum { MQ_HELLO=1, MQ_HELLO_OK, MQ_SUB, MQ_PUB, MQ_DATA, MQ_ACK } mq_type_t;
+typedef enum { MQ_HELLO=1, MQ_HELLO_OK, MQ_SUB, MQ_PUB, MQ_DATA, MQ_ACK, MQ_FWD, MQ_RESET } mq_type_t;
 
 #pragma pack(push,1)
 // Header compacto: tipo + seq (número de paquete) + ack + longitudes de campos variables.
 // En QUIC real los headers son más complejos (long/short header, connection IDs, etc.).
 typedef struct { uint8_t type; uint32_t seq, ack; uint16_t topic_len, data_len; } mq_hdr_t;
 #pragma pack(pop)
+// Versión 2 del header: con el bit MQ_HDR_CID en type, tras los campos fijos va un
+// Connection ID de 64 bits (orden de red). Lo elige el cliente al arrancar y el
+// broker lo usa para encontrar la conexión aunque cambie nuestra dirección.
+#define MQ_HDR_CID   0x80
+#define MQ_TYPE_MASK 0x7f
+static uint64_t conn_id;   // CID de esta conexión (aleatorio, bit alto a 0)
 
 typedef struct { mq_hdr_t hdr; char topic[128]; uint8_t data[MQ_MAX_PAYLOAD]; } mq_packet_t;
 
 /* now_ms:
    Utilidad para medir tiempos en ms.
-   Los timers en QUIC son más complejos (PTO, handshake timer, etc.), aquí se usa
-   un único timeout fijo para esperar ACKs. */
-static uint64_t now_ms(void){ struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts);
+   La espera del ACK del SUB usa un PTO calculado del RTT medido (mq_rtt_t),
+   como en QUIC, aunque sin timers de handshake ni de idle. */
+static uint64_t now_ms(void){ struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
   return (uint64_t)ts.tv_sec*1000ull + (uint64_t)(ts.tv_nsec/1000000ull); }
+// now_us: igual en microsegundos (ack_delay de los frames ACK).
+static uint64_t now_us(void){ struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec*1000000ull + (uint64_t)(ts.tv_nsec/1000ull); }
 
-/* mq_pack / mq_unpack:
+/* mq_pack / mq_parse:
    Serializan/deserializan header + topic + data.
    Se realizan conversiones de orden de bytes (htonl/htons).
    En QUIC existen frames (STREAM, ACK, CRYPTO...) y mecanismos binarios
    más ricos; esto es un análogo muy simplificado. */
 static size_t mq_pack(uint8_t* b, size_t bl, const mq_packet_t* p){
-  if (bl < sizeof(mq_hdr_t)) return 0;
-  mq_hdr_t h=p->hdr; h.seq=htonl(h.seq); h.ack=htonl(h.ack);
+  if (bl < sizeof(mq_hdr_t)+8) return 0;
+  mq_hdr_t h=p->hdr; h.type|=MQ_HDR_CID; h.seq=htonl(h.seq); h.ack=htonl(h.ack);
   h.topic_len=htons(h.topic_len); h.data_len=htons(h.data_len);
   memcpy(b,&h,sizeof(h)); size_t off=sizeof(h);
+  for(int i=0;i<8;i++) b[off++]=(uint8_t)(conn_id>>(56-8*i));   // siempre con CID
   if (p->hdr.topic_len){ if (off+p->hdr.topic_len>bl) return 0; memcpy(b+off,p->topic,p->hdr.topic_len); off+=p->hdr.topic_len; }
   if (p->hdr.data_len){ if (off+p->hdr.data_len>bl) return 0; memcpy(b+off,p->data,p->hdr.data_len); off+=p->hdr.data_len; }
   return off;
 }
-static bool mq_unpack(const uint8_t* b, size_t l, mq_packet_t* o){
-  if (l<sizeof(mq_hdr_t)) return false; memcpy(&o->hdr,b,sizeof(mq_hdr_t));
-  o->hdr.seq=ntohl(o->hdr.seq); o->hdr.ack=ntohl(o->hdr.ack);
-  o->hdr.topic_len=ntohs(o->hdr.topic_len); o->hdr.data_len=ntohs(o->hdr.data_len);
+/* mq_view_t / mq_parse: vista sin copias de un datagrama recibido. Valida la
+   cabecera y las longitudes; topic y data apuntan dentro del buffer original
+   (el topic NO termina en '\0': usar hdr.topic_len). */
+typedef struct { mq_hdr_t hdr; bool has_cid; uint64_t cid; const char* topic; const uint8_t* data; } mq_view_t;
+static bool mq_parse(const uint8_t* b, size_t l, mq_view_t* v){
+  if (l<sizeof(mq_hdr_t)) return false;
+  memcpy(&v->hdr,b,sizeof(mq_hdr_t));
+  v->hdr.seq=ntohl(v->hdr.seq); v->hdr.ack=ntohl(v->hdr.ack);
+  v->hdr.topic_len=ntohs(v->hdr.topic_len); v->hdr.data_len=ntohs(v->hdr.data_len);
   size_t off=sizeof(mq_hdr_t);
-  if (o->hdr.topic_len){ if (off+o->hdr.topic_len>l || o->hdr.topic_len>=sizeof(o->topic)) return false;
-    memcpy(o->topic,b+off,o->hdr.topic_len); o->topic[o->hdr.topic_len]='\0'; off+=o->hdr.topic_len; }
-  else o->topic[0]='\0';
-  if (o->hdr.data_len){ if (off+o->hdr.data_len>l || o->hdr.data_len>MQ_MAX_PAYLOAD) return false;
-    memcpy(o->data,b+off,o->hdr.data_len); }
+  v->has_cid=v->hdr.type&MQ_HDR_CID; v->hdr.type&=MQ_TYPE_MASK; v->cid=0;
+  if (v->has_cid){ if (l<off+8) return false; for(int i=0;i<8;i++) v->cid=v->cid<<8|b[off++]; }
+  if (v->hdr.topic_len>=sizeof(((mq_packet_t*)0)->topic) || off+v->hdr.topic_len>l) return false;
+  v->topic=(const char*)b+off; off+=v->hdr.topic_len;
+  if (v->hdr.data_len>MQ_MAX_PAYLOAD || off+v->hdr.data_len>l) return false;
+  v->data=b+off;
   return true;
 }
+// Sólo vale lo que llega del broker y, si trae CID, con el nuestro (no basta con que cuadre el ack).
+static bool mq_from_srv(const struct sockaddr_in* fr, const struct sockaddr_in* srv, const mq_view_t* v){
+  return fr->sin_addr.s_addr==srv->sin_addr.s_addr && fr->sin_port==srv->sin_port && (!v->has_cid || v->cid==conn_id); }
+// mq_new_cid: CID aleatorio para esta ejecución (bit alto reservado por el broker).
+static void mq_new_cid(void){
+  if(getrandom(&conn_id,sizeof(conn_id),0)!=(ssize_t)sizeof(conn_id)) conn_id=now_us()^((uint64_t)getpid()<<32);
+  conn_id&=~(1ull<<63); }
+
+/* --- Frames ACK con rangos (estilo QUIC) ---
+   data de un MQ_ACK: ack_delay_us (u32) | n (u8) | first_len (u32) | (n-1) x { gap (u32), len (u32) },
+   hdr.ack = mayor seq confirmado. Primer rango [largest-first_len, largest]; cada
+   rango siguiente empieza 'gap' seqs ausentes por debajo del anterior y cubre len+1.
+   Un MQ_ACK sin data es el ACK simple de antes (un solo seq en hdr.ack). */
+#define MQ_ACK_MAX_RANGES 32
+typedef struct { uint32_t lo, hi; } mq_range_t;                               // [lo, hi]
+typedef struct { int n; mq_range_t r[MQ_ACK_MAX_RANGES]; } mq_rangeset_t;     // descendente, disjuntos
+typedef struct { uint32_t ack_delay_us; mq_rangeset_t rs; } mq_ackframe_t;
+
+static bool rs_contains(const mq_rangeset_t* rs, uint32_t seq){
+  for(int i=0;i<rs->n;i++){ if(seq>rs->r[i].hi) return false; if(seq>=rs->r[i].lo) return true; }
+  return false;
+}
+// Inserta seq fusionando con vecinos; si no cabe otro rango se olvida el más viejo.
+static void rs_add(mq_rangeset_t* rs, uint32_t seq){
+  int i=0;
+  for(;i<rs->n;i++){ mq_range_t* r=&rs->r[i];
+    if(seq>r->hi){ if(seq==r->hi+1){ r->hi=seq; return; } break; }
+    if(seq>=r->lo) return;
+    if(seq==r->lo-1){ r->lo=seq;
+      if(i+1<rs->n && rs->r[i+1].hi==seq-1){ r->lo=rs->r[i+1].lo; memmove(&rs->r[i+1],&rs->r[i+2],(size_t)(rs->n-i-2)*sizeof(mq_range_t)); rs->n--; }
+      return; }
+  }
+  if(i==MQ_ACK_MAX_RANGES) return;
+  int n=rs->n<MQ_ACK_MAX_RANGES?rs->n:MQ_ACK_MAX_RANGES-1;
+  memmove(&rs->r[i+1],&rs->r[i],(size_t)(n-i)*sizeof(mq_range_t)); rs->r[i].lo=rs->r[i].hi=seq; rs->n=n+1;
+}
+static void put_u32(uint8_t* b, uint32_t v){ v=htonl(v); memcpy(b,&v,4); }
+static uint32_t get_u32(const uint8_t* b){ uint32_t v; memcpy(&v,b,4); return ntohl(v); }
+
+static size_t mq_ack_encode(uint8_t* b, size_t bl, const mq_ackframe_t* f){
+  size_t off=9; if(f->rs.n<1 || off+(size_t)(f->rs.n-1)*8>bl) return 0;
+  put_u32(b,f->ack_delay_us); b[4]=(uint8_t)f->rs.n; put_u32(b+5,f->rs.r[0].hi-f->rs.r[0].lo);
+  for(int i=1;i<f->rs.n;i++){ put_u32(b+off,f->rs.r[i-1].lo-f->rs.r[i].hi-1); put_u32(b+off+4,f->rs.r[i].hi-f->rs.r[i].lo); off+=8; }
+  return off;
+}
+// Extrae el frame de un MQ_ACK (con rangos o simple).
+static bool mq_ack_parse(const mq_view_t* p, mq_ackframe_t* f){
+  if(p->hdr.type!=MQ_ACK) return false;
+  if(!p->hdr.data_len){ f->ack_delay_us=0; f->rs.n=1; f->rs.r[0].lo=f->rs.r[0].hi=p->hdr.ack; return true; }
+  const uint8_t* b=p->data; size_t len=p->hdr.data_len; if(len<9) return false;
+  int n=b[4]; if(n<1 || n>MQ_ACK_MAX_RANGES || len<9+(size_t)(n-1)*8) return false;
+  f->ack_delay_us=get_u32(b); uint32_t hi=p->hdr.ack, span=get_u32(b+5); if(span>hi) return false;
+  f->rs.r[0].hi=hi; f->rs.r[0].lo=hi-span;
+  for(int i=1;i<n;i++){ uint32_t gap=get_u32(b+9+(i-1)*8), l=get_u32(b+13+(i-1)*8), plo=f->rs.r[i-1].lo;
+    if(gap>=plo) return false;
+    hi=plo-gap-1; if(l>hi) return false;
+    f->rs.r[i].hi=hi; f->rs.r[i].lo=hi-l; }
+  f->rs.n=n; return true;
+}
 
 /* mq_send_ack:
-   Envía un paquete MQ_ACK con el número ack indicado.
-   En QUIC los ACKs contienen rangos y delays; aquí es un ACK simple. */
-static int mq_send_ack(int s, const struct sockaddr_in* a, socklen_t al, uint32_t ack){
-  mq_packet_t p={0}; p.hdr.type=MQ_ACK; p.hdr.ack=ack; uint8_t buf[64]; size_t n=mq_pack(buf,sizeof(buf),&p);
+   Envía un paquete MQ_ACK con los rangos y el ack_delay del frame
+   (como el ACK frame de QUIC, ver mq_ack_encode). */
+static int mq_send_ack(int s, const struct sockaddr_in* a, socklen_t al, const mq_ackframe_t* f){
+  mq_packet_t p={0}; p.hdr.type=MQ_ACK; p.hdr.ack=f->rs.r[0].hi;
+  p.hdr.data_len=(uint16_t)mq_ack_encode(p.data,sizeof(p.data),f); if(!p.hdr.data_len) return -1;
+  uint8_t buf[1600]; size_t n=mq_pack(buf,sizeof(buf),&p);
   return (sendto(s,buf,n,0,(const struct sockaddr*)a,al)<0)?-1:0;
 }
 
+/* --- Estimación de RTT y PTO adaptativo (RFC 9002 §5-6) ---
+   En vez de un timeout fijo de 500 ms (~1000x el RTT de loopback/LAN) se mide el
+   RTT con cada ACK de un paquete enviado una sola vez (Karn) y se suaviza:
+   srtt = 7/8 srtt + 1/8 muestra, rttvar = 3/4 rttvar + 1/4 |srtt - muestra|,
+   descontando el ack_delay que reporta el peer. PTO = srtt + max(4*rttvar, 1 ms)
+   + max_ack_delay, duplicado por cada PTO consecutivo sin respuesta. Mientras no
+   hay muestras se usa MQ_TIMEOUT_MS. */
+#define MQ_GRANULARITY_US    1000  // resolución mínima del timer
+#define MQ_MAX_ACK_DELAY_MS  25    // ack_delay supuesto del peer hasta que reporte otro
+#define MQ_MAX_PTO_MS        4000  // tope del PTO con backoff
+
+typedef struct { uint64_t latest_us, min_rtt_us, srtt_us, rttvar_us, max_ack_delay_us; bool has_sample; int pto_count; } mq_rtt_t;
+
+static void rtt_init(mq_rtt_t* r){ memset(r,0,sizeof(*r)); r->max_ack_delay_us=MQ_MAX_ACK_DELAY_MS*1000ull; }
+static void rtt_on_sample(mq_rtt_t* r, uint64_t sample_us, uint64_t ack_delay_us){
+  if(ack_delay_us>r->max_ack_delay_us && ack_delay_us<MQ_MAX_PTO_MS*1000ull) r->max_ack_delay_us=ack_delay_us;
+  r->latest_us=sample_us;
+  if(!r->has_sample || sample_us<r->min_rtt_us) r->min_rtt_us=sample_us;
+  if(!r->has_sample){ r->srtt_us=sample_us; r->rttvar_us=sample_us/2; r->has_sample=true; return; }
+  uint64_t adj=sample_us; if(adj>=r->min_rtt_us+ack_delay_us) adj-=ack_delay_us;   // nunca por debajo de min_rtt
+  uint64_t dev=r->srtt_us>adj?r->srtt_us-adj:adj-r->srtt_us;
+  r->rttvar_us=(3*r->rttvar_us+dev)/4; r->srtt_us=(7*r->srtt_us+adj)/8;
+}
+static uint64_t rtt_pto_ms(const mq_rtt_t* r){
+  uint64_t pto=MQ_TIMEOUT_MS*1000ull;
+  if(r->has_sample){ uint64_t v=4*r->rttvar_us; pto=r->srtt_us+(v>MQ_GRANULARITY_US?v:MQ_GRANULARITY_US)+r->max_ack_delay_us; }
+  pto<<=(r->pto_count<16?r->pto_count:16);
+  uint64_t ms=(pto+999)/1000; return ms<MQ_MAX_PTO_MS?ms:MQ_MAX_PTO_MS;
+}
+
+/* --- Política de ACK diferido ---
+   Responder un MQ_ACK por cada DATA duplica los paquetes que atraviesan el broker.
+   Como en QUIC (RFC 9000 §13.2) el ACK se retiene hasta que:
+     - llegan ack_every DATA sin confirmar (opción -a), o
+     - pasan max_delay ms desde el primer DATA sin confirmar (opción -d), o
+     - llega un DATA fuera de orden o duplicado: hay hueco o se perdió un ACK,
+       y al emisor le conviene enterarse ya para retransmitir.
+   Como cada ACK lleva rangos, retenerlo no pierde información. Los contadores
+   msgs/acks miden cuántos ACK cuesta cada mensaje entregado. */
+#define MQ_SUBF_PACING    0x01 // flag en el data del SUB: pedir pacing al broker (opción -P)
+#define MQ_ACK_EVERY      2    // DATA por ACK (opción -a)
+#define MQ_MAX_ACK_DELAY  25   // ms máximos de retención de un ACK (opción -d)
+
+typedef struct {
+  mq_rangeset_t rx;                  // seqs recibidos (se confirman por rangos)
+  int ack_every, max_delay, pending; // pending = DATA recibidos sin confirmar
+  uint64_t pending_since, largest_at_us;
+  unsigned long msgs, acks;
+} mq_acker_t;
+
+static void acker_flush(int s, const struct sockaddr_in* a, socklen_t al, mq_acker_t* k){
+  if(!k->pending) return;
+  mq_ackframe_t af={ .ack_delay_us=(uint32_t)(now_us()-k->largest_at_us), .rs=k->rx };
+  if(mq_send_ack(s,a,al,&af)==0) k->acks++;
+  k->pending=0;
+}
+// Registra un DATA recibido y envía el ACK si la política lo pide.
+static void acker_on_data(int s, const struct sockaddr_in* a, socklen_t al, mq_acker_t* k, uint32_t seq){
+  bool in_order = k->rx.n==0 || seq==k->rx.r[0].hi+1;
+  bool dup = rs_contains(&k->rx,seq);
+  rs_add(&k->rx,seq); k->msgs++;
+  if(seq==k->rx.r[0].hi) k->largest_at_us=now_us();
+  if(!k->pending++) k->pending_since=now_ms();
+  if(!in_order || dup || k->pending>=k->ack_every) acker_flush(s,a,al,k);
+}
+// ms hasta que vence el ACK retenido (-1 si no hay ninguno).
+static int acker_timeout(const mq_acker_t* k){
+  if(!k->pending) return -1;
+  uint64_t el=now_ms()-k->pending_since;
+  return el>=(uint64_t)k->max_delay ? 0 : (int)(k->max_delay-el);
+}
+
+/* --- Modo sumidero (opción -S ms) ---
+   Para medir la capacidad del suscriptor sin la consola de por medio: no se
+   imprime nada por DATA; se cuentan mensajes y bytes y, con los seq del espacio
+   propio del suscriptor (consecutivos desde el broker), se detectan:
+     - huecos: seq saltados al llegar uno mayor que el siguiente esperado,
+     - recuperados: seq por debajo del mayor que no se habían recibido (la
+       retransmisión tapa un hueco),
+     - duplicados: seq ya recibidos (según los rangos del acker, así que un
+       duplicado muy antiguo cuenta como recuperado).
+   Pendientes = huecos - recuperados - perdidos, donde perdidos son los seq que
+   se dejaron de esperar (mq_rx_skip: el broker los abandonó o venció
+   MQ_RX_GIVEUP_MS). Los huecos sólo cuentan pérdidas del transporte
+   broker->suscriptor: un DATA que el broker descarta con la cola de este
+   suscriptor llena no llega a tener seq y no abre hueco; esos los anuncia el
+   broker en el MQ_FWD y salen aparte como descartados_broker. Esa clasificación mira lo que llega de la
+   red (sink_on_arrival); mensajes, bytes y latencia cuentan lo que se entrega a
+   la aplicación, ya sin duplicados y en orden (sink_on_msg). Si el payload
+   empieza por el instante de envío del publisher en modo carga (u64 µs de
+   CLOCK_MONOTONIC, sólo comparable en la misma máquina) se guarda la latencia
+   extremo a extremo, incluida la espera en el buffer de reordenación; los
+   valores imposibles (texto, otro host) se ignoran. Cada 'every_ms' se imprime
+   un resumen del intervalo y al salir el total. */
+#define MQ_LAT_MAX_US 60000000ull   // latencias por encima de esto no son marcas de tiempo
+
+typedef struct { uint64_t msgs, bytes, gaps, filled, dups, lost, bdrops; } mq_sinkcnt_t;
+typedef struct {
+  int every_ms; uint64_t t0, t_last, t_next;   // ms
+  uint32_t hi;                                // mayor seq recibido
+  uint32_t bdrops;                            // descartes del broker anunciados (acumulado)
+  mq_sinkcnt_t iv, tot;                       // intervalo en curso y acumulado
+  uint32_t* lat; size_t nlat, lcap;           // latencias del intervalo (µs)
+  double lat_max_ms;
+} mq_sink_t;
+
+static int cmp_u32(const void* a, const void* b){ uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b; return (x>y)-(x<y); }
+// Percentil q (0..1) de v ya ordenado, en ms.
+static double lat_pct_ms(const uint32_t* v, size_t n, double q){ return n ? v[(size_t)(q*(n-1))]/1000.0 : 0.0; }
+
+static void sink_init(mq_sink_t* k, int every_ms){
+  memset(k,0,sizeof(*k)); k->every_ms=every_ms; k->t0=k->t_last=now_ms(); k->t_next=k->t0+every_ms;
+}
+// Clasifica un DATA recién llegado; se llama antes de acker_on_data (rx todavía no incluye seq).
+static void sink_on_arrival(mq_sink_t* k, const mq_acker_t* ak, uint32_t seq){
+  if(rs_contains(&ak->rx,seq)) k->iv.dups++;
+  else if(seq>k->hi){ k->iv.gaps+=seq-k->hi-1; k->hi=seq; }
+  else k->iv.filled++;
+}
+// Cuenta n seq consecutivos desde lo que ya no se esperan; los que no habían
+// abierto hueco (por encima del mayor recibido) se cuentan también como hueco.
+static void sink_on_lost(mq_sink_t* k, uint32_t lo, uint32_t n){
+  uint32_t last=lo+n-1;
+  if(last>k->hi){ k->iv.gaps+=last-k->hi; k->hi=last; }
+  k->iv.lost+=n;
+}
+// Total de descartes por cola llena que anuncia el broker (MQ_FWD); puede llegar desordenado.
+static void sink_on_bdrops(mq_sink_t* k, uint32_t total){
+  if((int32_t)(total-k->bdrops)>0){ k->iv.bdrops+=total-k->bdrops; k->bdrops=total; }
+}
+// Cuenta un mensaje entregado a la aplicación.
+static void sink_on_msg(mq_sink_t* k, const uint8_t* data, uint16_t len){
+  k->iv.msgs++; k->iv.bytes+=len;
+  if(len>=8){
+    uint64_t ts=(uint64_t)get_u32(data)<<32 | get_u32(data+4), t=now_us();
+    if(ts<=t && t-ts<MQ_LAT_MAX_US){
+      if(k->nlat==k->lcap){
+        size_t nc=k->lcap?2*k->lcap:4096; uint32_t* nl=realloc(k->lat,nc*sizeof(*nl)); if(!nl) return;
+        k->lat=nl; k->lcap=nc;
+      }
+      k->lat[k->nlat++]=(uint32_t)(t-ts);
+    }
+  }
+}
+// ms hasta el próximo resumen (-1 si el modo sumidero está apagado).
+static int sink_timeout(const mq_sink_t* k){
+  if(!k->every_ms) return -1;
+  uint64_t t=now_ms(); return t>=k->t_next ? 0 : (int)(k->t_next-t);
+}
+// Imprime el resumen del intervalo y lo acumula en el total.
+static void sink_report(mq_sink_t* k){
+  uint64_t t=now_ms(); double el=(t-k->t_last)/1000.0;
+  mq_sinkcnt_t* c=&k->iv; mq_sinkcnt_t* s=&k->tot;
+  s->msgs+=c->msgs; s->bytes+=c->bytes; s->gaps+=c->gaps; s->filled+=c->filled; s->dups+=c->dups; s->lost+=c->lost; s->bdrops+=c->bdrops;
+  qsort(k->lat,k->nlat,sizeof(*k->lat),cmp_u32);
+  double mx=lat_pct_ms(k->lat,k->nlat,1.0); if(mx>k->lat_max_ms) k->lat_max_ms=mx;
+  printf("[sub] %7.1f s: %.0f msg/s %.2f MB/s | huecos %llu recuperados %llu perdidos %llu dup %llu pendientes %lld"
+         " descartados_broker %llu | lat p50=%.3f p99=%.3f max=%.3f ms\n", (t-k->t0)/1000.0,
+         el>0?c->msgs/el:0.0, el>0?c->bytes/el/1e6:0.0, (unsigned long long)c->gaps, (unsigned long long)c->filled,
+         (unsigned long long)c->lost, (unsigned long long)c->dups, (long long)(s->gaps-s->filled-s->lost),
+         (unsigned long long)c->bdrops,
+         lat_pct_ms(k->lat,k->nlat,0.5), lat_pct_ms(k->lat,k->nlat,0.99), mx);
+  fflush(stdout);
+  memset(c,0,sizeof(*c)); k->nlat=0; k->t_last=t;
+  while(k->t_next<=t) k->t_next+=k->every_ms;
+}
+
+/* --- Ventana de recepción: sin duplicados y en orden ---
+   Los DATA del broker llevan seq consecutivos desde 1 en el espacio de este
+   suscriptor, así que la aplicación debe ver 1, 2, 3... exactamente una vez:
+     - seq == next: se entrega directamente desde el buffer de recepción y
+       después se vacían los que esperaban en el buffer a continuación;
+     - next < seq < next+size: llegó antes que algún hueco; se copia a la ranura
+       seq % size y se entrega en cuanto se tape el hueco (la retransmisión del
+       broker la disparan los rangos del ACK, sin vueltas extra);
+     - seq < next o ya en el buffer: duplicado (se perdió nuestro ACK y el broker
+       repitió); se descarta pero se confirma otra vez;
+     - seq >= next+size: no cabe; se descarta SIN confirmarlo, así el broker lo
+       repetirá cuando haya sitio. Con una ventana (-w) no menor que la del
+       broker no debería ocurrir.
+   Un hueco no puede bloquear la entrega para siempre: si el broker agota
+   MQ_MAX_RETX con un seq lo abandona y lo dice con el forward seq (hdr.ack de
+   cada DATA y un MQ_FWD suelto), y todo lo que falte por debajo se da por
+   perdido (mq_rx_skip). Por si ese aviso también se pierde, un hueco con
+   mensajes esperando detrás se abandona pasados MQ_RX_GIVEUP_MS. */
+#define MQ_RX_WINDOW    256     // ranuras del buffer de reordenación (opción -w)
+#define MQ_RX_GIVEUP_MS 15000   // espera máxima de un hueco (por encima de lo que tarda el broker en agotar MQ_MAX_RETX)
+
+typedef struct { bool used; uint16_t tl, dl; char topic[128]; uint8_t data[MQ_MAX_PAYLOAD]; } mq_rxslot_t;
+typedef struct {
+  uint32_t next, size, held; mq_rxslot_t* slot;   // held = ranuras ocupadas
+  uint64_t hole_ms;                                // desde cuándo se espera a next con mensajes detrás
+  unsigned long delivered, dups, reordered, beyond, lost;
+} mq_rxwin_t;
+
+static bool rxwin_init(mq_rxwin_t* w, uint32_t size){
+  memset(w,0,sizeof(*w)); w->next=1; w->size=size;
+  w->slot=calloc(size,sizeof(*w->slot)); return w->slot!=NULL;
+}
+
+/* --- Demultiplexor de entrada ---
+   Todo datagrama leído del socket pasa por un único punto, mq_dispatch, que lo
+   entrega a su destinatario: un ACK al envío fiable pendiente (el SUB) y un DATA
+   al acker. Así la espera del ACK del SUB ya no lee y descarta los DATA que el
+   broker empieza a enviar en cuanto registra la suscripción (antes se perdían
+   y el broker tenía que retransmitirlos tras un PTO).
+   Las lecturas usan recvmmsg() con hasta 'batch' datagramas (opción -b; 1 por
+   defecto, MQ_RX_BATCH en modo sumidero), cada uno con su cmsg de GRO. */
+#define MQ_RX_BATCH  32      // datagramas por recvmmsg() como máximo
+#define MQ_RX_BUFSZ  2048    // buffer por datagrama sin GRO
+#define MQ_GRO_BUFSZ 65536   // con GRO cada lectura puede traer un súper-datagrama
+typedef struct { uint32_t seq; uint64_t sent_us; int tries; bool acked; } mq_pending_t;
+typedef struct {
+  int s; const struct sockaddr_in* srv; mq_acker_t* ak;
+  mq_pending_t* pend; mq_rtt_t* rtt;   // envío fiable en curso (NULL si no hay)
+  mq_rxwin_t* win;                     // entrega sin duplicados y en orden
+  mq_sink_t* sink;                     // modo sumidero (NULL: imprimir cada DATA)
+  unsigned long reads;
+  uint32_t bdrops, bdrops_prev;        // DATA descartados por el broker con nuestra cola llena (MQ_FWD),
+                                       // en esta conexión y en las anteriores (MQ_RESET)
+  bool reset;                          // el broker cerró la conexión: volver a suscribirse
+} mq_rx_t;
+
+static int rx_batch=1;
+static uint8_t* rx_buf[MQ_RX_BATCH];
+static size_t rx_bufsz;
+static struct sockaddr_in rx_from[MQ_RX_BATCH];
+static struct iovec rx_iov[MQ_RX_BATCH];
+static struct mmsghdr rx_msgs[MQ_RX_BATCH];
+static union { char b[CMSG_SPACE(sizeof(int))]; struct cmsghdr al; } rx_ctl[MQ_RX_BATCH];
+
+static bool rx_init(int batch, bool gro){
+  rx_batch=batch; rx_bufsz=gro?MQ_GRO_BUFSZ:MQ_RX_BUFSZ;
+  for(int i=0;i<batch;i++){ rx_buf[i]=malloc(rx_bufsz); if(!rx_buf[i]) return false; }
+  return true;
+}
+
+// Entrega un mensaje a la aplicación: imprimirlo o, en modo sumidero, contarlo.
+static void mq_deliver(mq_rx_t* rx, uint32_t seq, const char* topic, uint16_t tl, const uint8_t* data, uint16_t dl){
+  rx->win->delivered++;
+  if(rx->sink){ sink_on_msg(rx->sink,data,dl); return; }
+  printf("[sub] msg(topic=%.*s, seq=%u, len=%u): ", (int)tl, topic, seq, dl);
+  fwrite(data,1,dl,stdout); printf("\n");
+}
+// Entrega los que esperaban en el buffer a partir de next y rearma la espera del hueco.
+static void mq_rx_drain(mq_rx_t* rx){
+  mq_rxwin_t* w=rx->win;
+  for(mq_rxslot_t* sl; (sl=&w->slot[w->next%w->size])->used; w->next++){
+    mq_deliver(rx,w->next,sl->topic,sl->tl,sl->data,sl->dl); sl->used=false; w->held--;
+  }
+  w->hole_ms=w->held?now_ms():0;
+}
+// Deja de esperar los seq que falten por debajo de fwd (cuentan como perdidos)
+// y entrega lo que había detrás.
+static void mq_rx_skip(mq_rx_t* rx, uint32_t fwd){
+  mq_rxwin_t* w=rx->win;
+  while((int32_t)(fwd-w->next)>0){
+    uint32_t lo=w->next;
+    if(!w->held) w->next=fwd;   // nada en el buffer: saltar de una vez
+    else while(w->next!=fwd && !w->slot[w->next%w->size].used) w->next++;
+    if(w->next!=lo){ w->lost+=w->next-lo; if(rx->sink) sink_on_lost(rx->sink,lo,w->next-lo); }
+    mq_rx_drain(rx);
+  }
+}
+// ms hasta que se abandona el hueco actual (-1 si no hay mensajes esperando).
+static int rxwin_timeout(const mq_rxwin_t* w){
+  if(!w->held) return -1;
+  uint64_t el=now_ms()-w->hole_ms;
+  return el>=MQ_RX_GIVEUP_MS ? 0 : (int)(MQ_RX_GIVEUP_MS-el);
+}
+// Venció el hueco sin retransmisión ni forward seq: saltar hasta el primero guardado.
+static void mq_rx_giveup(mq_rx_t* rx){
+  mq_rxwin_t* w=rx->win; uint32_t off=1;
+  while(off<w->size && !w->slot[(w->next+off)%w->size].used) off++;
+  fprintf(stderr,"[sub] hueco seq=%u..%u sin retransmisión en %d ms: se da por perdido\n",
+          w->next, w->next+off-1, MQ_RX_GIVEUP_MS);
+  mq_rx_skip(rx,w->next+off);
+}
+// Aplica la ventana de recepción a un DATA; false si no cabe (no se confirma).
+static bool mq_on_data(mq_rx_t* rx, const mq_view_t* p){
+  mq_rxwin_t* w=rx->win; uint32_t seq=p->hdr.seq, off=seq-w->next;
+  if((int32_t)off<0 || (off<w->size && w->slot[seq%w->size].used)){ w->dups++; return true; }
+  if(off>=w->size){ w->beyond++; return false; }
+  if(off>0){
+    mq_rxslot_t* sl=&w->slot[seq%w->size];
+    sl->used=true; sl->tl=p->hdr.topic_len; sl->dl=p->hdr.data_len;
+    memcpy(sl->topic,p->topic,sl->tl); memcpy(sl->data,p->data,sl->dl);
+    if(!w->held++) w->hole_ms=now_ms();
+    w->reordered++; return true;
+  }
+  // Mostrar mensaje (directamente desde el buffer de recepción) y los que esperaban detrás
+  mq_deliver(rx,seq,p->topic,p->hdr.topic_len,p->data,p->hdr.data_len); w->next++;
+  mq_rx_drain(rx);
+  return true;
+}
+
+static void mq_dispatch(mq_rx_t* rx, const mq_view_t* p){
+  mq_ackframe_t af;
+  switch(p->hdr.type){
+  case MQ_ACK:
+    if(!rx->pend || rx->pend->acked || !mq_ack_parse(p,&af) || !rs_contains(&af.rs,rx->pend->seq)) break;
+    if(!rx->pend->tries) rtt_on_sample(rx->rtt,now_us()-rx->pend->sent_us,af.ack_delay_us);
+    rx->rtt->pto_count=0; rx->pend->acked=true; break;
+  case MQ_RESET:
+    rx->reset=true; break;
+  case MQ_FWD:
+    if(rx->reset) break;   // de la conexión que ya no existe
+    if((int32_t)(p->hdr.seq-rx->bdrops)>0) rx->bdrops=p->hdr.seq;
+    if(rx->sink) sink_on_bdrops(rx->sink,p->hdr.seq);
+    mq_rx_skip(rx,p->hdr.ack); break;
+  case MQ_DATA:
+    if(rx->reset) break;
+    if(p->hdr.ack) mq_rx_skip(rx,p->hdr.ack);   // forward seq: lo de debajo ya no llegará
+    if(rx->sink) sink_on_arrival(rx->sink,rx->ak,p->hdr.seq);
+    // Entregar (o guardar hasta que se tape el hueco) y confirmar al broker
+    // según la política (inmediato si hay hueco/duplicado)
+    if(mq_on_data(rx,p)) acker_on_data(rx->s,rx->srv,sizeof(*rx->srv),rx->ak,p->hdr.seq);
+    break;
+  default: break;
+  }
+}
+// Una lectura del socket: hasta rx_batch datagramas y, con GRO, cada uno puede
+// traer varios de 'seg' bytes (cmsg UDP_GRO); cada uno se valida y se despacha.
+static void mq_recv(mq_rx_t* rx){
+  for(int i=0;i<rx_batch;i++){
+    rx_iov[i]=(struct iovec){ rx_buf[i], rx_bufsz };
+    rx_msgs[i].msg_hdr=(struct msghdr){ .msg_name=&rx_from[i], .msg_namelen=sizeof(rx_from[i]), .msg_iov=&rx_iov[i],
+                                        .msg_iovlen=1, .msg_control=rx_ctl[i].b, .msg_controllen=sizeof(rx_ctl[i].b) };
+  }
+  int n=recvmmsg(rx->s,rx_msgs,rx_batch,MSG_DONTWAIT,NULL); rx->reads++;
+  for(int i=0;i<n;i++){
+    struct msghdr* mh=&rx_msgs[i].msg_hdr; size_t rn=rx_msgs[i].msg_len, seg=rn;
+    for(struct cmsghdr* cm=CMSG_FIRSTHDR(mh); cm; cm=CMSG_NXTHDR(mh,cm))
+      if(cm->cmsg_level==SOL_UDP && cm->cmsg_type==UDP_GRO){ int g; memcpy(&g,CMSG_DATA(cm),sizeof(g)); if(g>0) seg=(size_t)g; }
+    for(size_t off=0; seg && off<rn; off+=seg){
+      mq_view_t p; if(!mq_parse(rx_buf[i]+off,rn-off<seg?rn-off:seg,&p) || !mq_from_srv(&rx_from[i],rx->srv,&p)) continue;
+      mq_dispatch(rx,&p);
+    }
+  }
+}
+
 /* mq_send_reliable:
    Envío fiable simplificado en espacio de usuario:
    - Serializa el paquete y lo envía por UDP.
-   - Espera un MQ_ACK que confirme p->hdr.seq usando select() con timeout.
+   - Espera, con select() y timeout = PTO, a que mq_dispatch marque p->hdr.seq
+     como confirmado; lo demás que llegue mientras tanto (DATA) se atiende igual
+     que en el bucle principal, incluido el vencimiento del ACK diferido.
    - Si no llega, retransmite hasta MQ_MAX_RETX intentos.
-   Observación: este patrón reproduce la filosofía de QUIC (fiabilidad en usuario),
-   pero sin la complejidad real (pérdida basada en ranges, timers adaptativos,
-   control de congestión, etc.). */
-static int mq_send_reliable(int s, const struct sockaddr_in* a, socklen_t al, mq_packet_t* p){
-  uint8_t buf[1600]; size_t n=mq_pack(buf,sizeof(buf),p); if(!n) return -1; int tries=0;
-  while(tries<MQ_MAX_RETX){
-    if (sendto(s,buf,n,0,(const struct sockaddr*)a,al)<0){ perror("sendto"); return -1; }
-    uint64_t start=now_ms();
-    for(;;){
-      uint64_t el=now_ms()-start; if(el>=MQ_TIMEOUT_MS) break;
-      struct timeval tv={.tv_sec=(MQ_TIMEOUT_MS-el)/1000,.tv_usec=((MQ_TIMEOUT_MS-el)%1000)*1000};
-      fd_set f; FD_ZERO(&f); FD_SET(s,&f);
-      int r=select(s+1,&f,NULL,NULL,&tv);
-      if(r>0 && FD_ISSET(s,&f)){
-        uint8_t rb[1600]; struct sockaddr_in fr; socklen_t fl=sizeof(fr);
-        ssize_t rn=recvfrom(s,rb,sizeof(rb),0,(struct sockaddr*)&fr,&fl);
-        if(rn>0){ mq_packet_t ap; if(mq_unpack(rb,rn,&ap)&&ap.hdr.type==MQ_ACK&&ap.hdr.ack==p->hdr.seq) return 0; }
-      } else if (r<0 && errno!=EINTR){ perror("select"); break; }
+   Observación: este patrón reproduce la filosofía de QUIC (fiabilidad en usuario)
+   y su PTO adaptativo (RTT suavizado + varianza, con backoff en cada reintento),
+   pero sin la complejidad real: es un único paquete en vuelo, sin detección de
+   pérdida por rangos ni control de congestión. */
+static int mq_send_reliable(mq_rx_t* rx, mq_packet_t* p, mq_rtt_t* rtt){
+  uint8_t buf[1600]; size_t n=mq_pack(buf,sizeof(buf),p); if(!n) return -1;
+  mq_pending_t pend={ .seq=p->hdr.seq, .sent_us=now_us() };
+  rx->pend=&pend; rx->rtt=rtt;
+  while(pend.tries<MQ_MAX_RETX){
+    if (sendto(rx->s,buf,n,0,(const struct sockaddr*)rx->srv,sizeof(*rx->srv))<0){ perror("sendto"); break; }
+    uint64_t start=now_ms(), pto=rtt_pto_ms(rtt);
+    while(!pend.acked){
+      uint64_t el=now_ms()-start; if(el>=pto) break;
+      uint64_t left=pto-el; int at=acker_timeout(rx->ak); if(at>=0 && (uint64_t)at<left) left=(uint64_t)at;
+      struct timeval tv={.tv_sec=left/1000,.tv_usec=(left%1000)*1000};
+      fd_set f; FD_ZERO(&f); FD_SET(rx->s,&f);
+      int r=select(rx->s+1,&f,NULL,NULL,&tv);
+      if(r>0 && FD_ISSET(rx->s,&f)) mq_recv(rx);
+      else if (r<0 && errno!=EINTR){ perror("select"); break; }
+      if(acker_timeout(rx->ak)==0) acker_flush(rx->s,rx->srv,sizeof(*rx->srv),rx->ak);
     }
-    tries++;
+    if(pend.acked){ rx->pend=NULL; return 0; }
+    pend.tries++; rtt->pto_count++;
   }
+  rx->pend=NULL;
   fprintf(stderr,"[sub] timeout esperando ACK seq=%u\n", p->hdr.seq); return -1;
 }
 
+// HELLO: saludo simple al broker.
+// En QUIC real habría un handshake CRYPTO/TLS y derivación de claves.
+static void mq_send_hello(const mq_rx_t* rx){
+  mq_packet_t hello={0}; hello.hdr.type=MQ_HELLO; uint8_t hb[64]; size_t hn=mq_pack(hb,sizeof(hb),&hello);
+  sendto(rx->s,hb,hn,0,(const struct sockaddr*)rx->srv,sizeof(*rx->srv));
+}
+
+/* mq_resubscribe:
+   Tras un MQ_RESET (el broker nos dio de baja, p. ej. porque el proceso estuvo
+   parado y dejó de confirmar) se abre una conexión nueva con otro CID, así que
+   lo que aún llegue de la anterior lo descarta mq_from_srv, y se repite el SUB.
+   Los seq vuelven a empezar en 1: lo que quedaba en la ventana se entrega, los
+   huecos cuentan como perdidos y la ventana y el acker se vacían; los contadores
+   se conservan. */
+static int mq_resubscribe(mq_rx_t* rx, mq_packet_t* sub, mq_rtt_t* rtt){
+  if(rx->ak->rx.n) mq_rx_skip(rx,rx->ak->rx.r[0].hi+1);
+  rx->win->next=1; rx->ak->rx.n=0; rx->ak->pending=0;
+  rx->bdrops_prev+=rx->bdrops; rx->bdrops=0;
+  if(rx->sink){ rx->sink->hi=0; rx->sink->bdrops=0; }
+  rx->reset=false;
+  mq_new_cid(); mq_send_hello(rx);
+  return mq_send_reliable(rx,sub,rtt);
+}
+
+static volatile sig_atomic_t stop;
+static void on_signal(int sig){ (void)sig; stop=1; }
+
 /* main:
-   - Uso: <host> <port> <topic>
+   - Uso: <host> <port> <topic> [-a ack_cada_N] [-d max_ack_delay_ms] [-P] [-r rcvbuf] [-g]
+          [-b lote_rx] [-S intervalo_ms] [-w ventana_rx]
+       -P pide al broker que espacie (pacing) los envíos a este suscriptor;
+       -r fija SO_RCVBUF (útil para provocar pérdidas por ráfagas en benchmarks);
+       -b lee hasta lote_rx datagramas por recvmmsg() (1..MQ_RX_BATCH);
+       -S modo sumidero: no imprime cada DATA y resume ritmo, huecos, duplicados
+          y latencia cada intervalo_ms (ver mq_sink_t); lote_rx pasa a MQ_RX_BATCH;
+       -w ranuras del buffer de reordenación (ver mq_rxwin_t, por defecto MQ_RX_WINDOW).
    - Realiza:
        1) HELLO (saludo simple; en QUIC real habría handshake TLS/CRYPTO)
-       2) SUB(topic) con seq=1 enviado de forma fiable (mq_send_reliable)
-       3) En bucle: recibe datagramas; si recibe MQ_DATA imprime y responde MQ_ACK
+       2) SUB(topic) con seq=1 enviado de forma fiable (mq_send_reliable); los
+          DATA que lleguen antes de su ACK ya se procesan (mq_dispatch)
+       3) En bucle: recibe datagramas; cada MQ_DATA se entrega una sola vez y en orden
+          de seq (se imprime o, con -S, se cuenta) y se confirma
+          con un MQ_ACK con rangos según la política de ACK diferido (mq_acker_t)
+          y, si el broker avisa con MQ_RESET de que cerró la conexión, se vuelve a
+          suscribir con una nueva (mq_resubscribe)
+       4) Con SIGINT/SIGTERM envía el ACK pendiente e imprime los contadores
    - Observaciones sobre diseño:
        - El cliente espera DATA del broker en el mismo socket UDP desde el que
          realizó la suscripción; en QUIC cada endpoint tendría una "conexión"
          y mecanismos para proteger/derivar claves.
-       - El ACK que envía el suscriptor al recibir DATA es sencillo y confirma
-         el número de secuencia; QUIC envía ACKs con ranges y delay_time.
-       - La numeración de paquetes aquí es un simple contador (publisher define
-         seqs), no hay espacios de números o reenvío avanzado. */
+       - El ACK que envía el suscriptor al recibir DATA lleva los últimos
+         MQ_ACK_MAX_RANGES rangos recibidos y el ack_delay, como en QUIC: si un
+         ACK se pierde, el siguiente vuelve a cubrir esos seq.
+       - Los seq que ve el suscriptor los asigna el broker en un espacio propio de
+         esta suscripción (1, 2, 3...), no son los del publisher: varios publishers
+         se intercalan sin colisiones y un hueco es una pérdida broker->suscriptor. */
 int main(int argc, char** argv){
-  if(argc<4){ fprintf(stderr,"Uso: %s <host> <port> <topic>\n",argv[0]); return 1; }
-  const char* host=argv[1]; int port=atoi(argv[2]); const char* topic=argv[3];
+  mq_acker_t ak={ .ack_every=MQ_ACK_EVERY, .max_delay=MQ_MAX_ACK_DELAY };
+  int opt, rcvbuf=0, batch=0, every=0, rxwin=MQ_RX_WINDOW; bool bad=false, gro=false; uint8_t sub_flags=0;
+  while((opt=getopt(argc,argv,"a:d:Pr:gb:S:w:"))!=-1){
+    if(opt=='a') ak.ack_every=atoi(optarg); else if(opt=='d') ak.max_delay=atoi(optarg);
+    else if(opt=='P') sub_flags|=MQ_SUBF_PACING; else if(opt=='r') rcvbuf=atoi(optarg);
+    else if(opt=='g') gro=true; else if(opt=='b'){ batch=atoi(optarg); if(batch<1) bad=true; }
+    else if(opt=='S'){ every=atoi(optarg); if(every<1) bad=true; }
+    else if(opt=='w'){ rxwin=atoi(optarg); if(rxwin<1) bad=true; } else bad=true;
+  }
+  if(bad || argc-optind<3 || ak.ack_every<1 || ak.max_delay<0 || batch>MQ_RX_BATCH){
+    fprintf(stderr,"Uso: %s <host> <port> <topic> [-a ack_cada_N] [-d max_ack_delay_ms] [-P] [-r rcvbuf] [-g]"
+                   " [-b lote_rx (1..%d)] [-S intervalo_ms] [-w ventana_rx]\n",argv[0],MQ_RX_BATCH); return 1; }
+  if(!batch) batch=every?MQ_RX_BATCH:1;
+  const char* host=argv[optind]; int port=atoi(argv[optind+1]); const char* topic=argv[optind+2];
+  struct sigaction sa={0}; sa.sa_handler=on_signal;   // sin SA_RESTART: select() vuelve con EINTR
+  sigaction(SIGINT,&sa,NULL); sigaction(SIGTERM,&sa,NULL);
   int s=socket(AF_INET,SOCK_DGRAM,0); if(s<0){ perror("socket"); return 1; }
+  if(rcvbuf>0 && setsockopt(s,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf))<0) perror("setsockopt(SO_RCVBUF)");
+  // -g: GRO, el kernel puede entregar varios DATA del broker en una sola lectura
+  int one=1; if(gro && setsockopt(s,SOL_UDP,UDP_GRO,&one,sizeof(one))<0){ perror("setsockopt(UDP_GRO)"); gro=false; }
   struct sockaddr_in srv={0}; srv.sin_family=AF_INET; srv.sin_port=htons(port);
   if(inet_pton(AF_INET,host,&srv.sin_addr)!=1){ fprintf(stderr,"Dirección inválida\n"); return 1; }
-
-  // HELLO: saludo simple al broker.
-  // En QUIC real habría un handshake CRYPTO/TLS y derivación de claves.
-  mq_packet_t hello={0}; hello.hdr.type=MQ_HELLO; uint8_t hb[64]; size_t hn=mq_pack(hb,sizeof(hb),&hello);
-  sendto(s,hb,hn,0,(struct sockaddr*)&srv,sizeof(srv));
+  mq_rxwin_t win; if(!rx_init(batch,gro) || !rxwin_init(&win,(uint32_t)rxwin)){ perror("malloc"); return 1; }
+  mq_new_cid();
 
   // SUB(topic) seq=1 -> envío fiable (espera ACK del broker)
+  mq_rtt_t rtt; rtt_init(&rtt);
   mq_packet_t sub={0}; sub.hdr.type=MQ_SUB; sub.hdr.seq=1;
   sub.hdr.topic_len=(uint16_t)strlen(topic); strncpy(sub.topic,topic,sizeof(sub.topic)-1);
-  if(mq_send_reliable(s,&srv,sizeof(srv),&sub)!=0){ fprintf(stderr,"Fallo al suscribirse\n"); return 1; }
-  printf("[sub] suscrito a '%s'\n", topic);
-
-  // Bucle principal: recibir DATA y responder ACK al broker
-  for(;;){
-    uint8_t rb[2000]; struct sockaddr_in fr; socklen_t fl=sizeof(fr);
-    ssize_t rn=recvfrom(s,rb,sizeof(rb),0,(struct sockaddr*)&fr,&fl);
-    if(rn<=0) continue;
-    mq_packet_t p; if(!mq_unpack(rb,rn,&p)) continue;
-    if(p.hdr.type==MQ_DATA){
-      // Mostrar mensaje y enviar ACK al broker (srv)
-      printf("[sub] msg(topic=%s, seq=%u, len=%u): ", p.topic, p.hdr.seq, p.hdr.data_len);
-      fwrite(p.data,1,p.hdr.data_len,stdout); printf("\n");
-      // Enviar ACK al servidor/broker: confirmamos la recepción
-      mq_send_ack(s,&srv,sizeof(srv),p.hdr.seq);
+  if(sub_flags){ sub.data[0]=sub_flags; sub.hdr.data_len=1; }   // flags opcionales del SUB
+  mq_sink_t sink; if(every) sink_init(&sink,every);
+  mq_rx_t rx={ .s=s, .srv=&srv, .ak=&ak, .win=&win, .sink=every?&sink:NULL };
+  mq_send_hello(&rx);
+  if(mq_send_reliable(&rx,&sub,&rtt)!=0){ fprintf(stderr,"Fallo al suscribirse\n"); return 1; }
+  printf("[sub] suscrito a '%s' (cid=%016llx)\n", topic, (unsigned long long)conn_id);
+
+  // Bucle principal: recibir DATA y confirmar al broker (ACK diferido).
+  while(!stop){
+    int tmo=acker_timeout(&ak), st=every?sink_timeout(&sink):-1, wt=rxwin_timeout(&win);
+    if(st>=0 && (tmo<0 || st<tmo)) tmo=st;
+    if(wt>=0 && (tmo<0 || wt<tmo)) tmo=wt;
+    struct timeval tv={.tv_sec=tmo/1000,.tv_usec=(tmo%1000)*1000};
+    fd_set f; FD_ZERO(&f); FD_SET(s,&f);
+    int r=select(s+1,&f,NULL,NULL,tmo<0?NULL:&tv);
+    if(r<0 && errno!=EINTR){ perror("select"); break; }
+    if(r>0) mq_recv(&rx);
+    if(acker_timeout(&ak)==0) acker_flush(s,&srv,sizeof(srv),&ak);
+    if(rxwin_timeout(&win)==0) mq_rx_giveup(&rx);
+    if(every && sink_timeout(&sink)==0) sink_report(&sink);
+    if(rx.reset && !stop){
+      fprintf(stderr,"[sub] el broker cerró la conexión %016llx: se vuelve a suscribir\n", (unsigned long long)conn_id);
+      if(mq_resubscribe(&rx,&sub,&rtt)!=0){ fprintf(stderr,"Fallo al volver a suscribirse\n"); break; }
+      printf("[sub] suscrito a '%s' (cid=%016llx)\n", topic, (unsigned long long)conn_id);
     }
   }
+  acker_flush(s,&srv,sizeof(srv),&ak);
+  if(every){
+    sink_report(&sink); const mq_sinkcnt_t* c=&sink.tot; double el=(now_ms()-sink.t0)/1000.0;
+    printf("[sub] total: %llu msgs, %llu B en %.3f s -> %.0f msg/s %.2f MB/s | huecos %llu recuperados %llu perdidos %llu"
+           " dup %llu pendientes %lld descartados_broker %llu | lat max=%.3f ms\n", (unsigned long long)c->msgs,
+           (unsigned long long)c->bytes, el, el>0?c->msgs/el:0.0, el>0?c->bytes/el/1e6:0.0, (unsigned long long)c->gaps,
+           (unsigned long long)c->filled, (unsigned long long)c->lost, (unsigned long long)c->dups,
+           (long long)(c->gaps-c->filled-c->lost), (unsigned long long)c->bdrops, sink.lat_max_ms);
+    free(sink.lat);
+  }
+  printf("[sub] %lu DATA recibidos, %lu ACKs enviados (%.3f ACK/msg), %lu lecturas (%.3f lecturas/msg)\n",
+         ak.msgs, ak.acks, ak.msgs?(double)ak.acks/ak.msgs:0.0, rx.reads, ak.msgs?(double)rx.reads/ak.msgs:0.0);
+  printf("[sub] %lu entregados en orden, %lu duplicados descartados, %lu reordenados, %lu fuera de ventana,"
+         " %lu perdidos, %lu descartados por el broker (cola llena)\n",
+         win.delivered, win.dups, win.reordered, win.beyond, win.lost, (unsigned long)(rx.bdrops_prev+rx.bdrops));
+  free(win.slot);
+  return 0;
 }